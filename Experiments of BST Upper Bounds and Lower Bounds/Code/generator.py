@@ -1,5 +1,7 @@
 import random
 import argparse
+import struct
+from array import array
 
 
 def is_power_of_two(n):
@@ -55,11 +57,41 @@ def generate_zigzag(n):
     return seq
 
 
+def generate_churn(n, insert_ratio=0.25, delete_ratio=0.25):
+    key_range = (1, 2 * n + 1)
+    ops = []
+    for _ in range(n):
+        r = random.random()
+        if r < insert_ratio:
+            op = "I"
+        elif r < insert_ratio + delete_ratio:
+            op = "D"
+        else:
+            op = "S"
+        ops.append((op, random.randint(*key_range)))
+    return ops
+
+
+def write_operations_to_file(ops, output_file):
+    with open(output_file, "w") as f:
+        f.write("\n".join(f"{op} {key}" for op, key in ops))
+
+
 def write_sequence_to_file(seq, output_file):
     with open(output_file, "w") as f:
         f.write(" ".join(map(str, seq)))
 
 
+# Same layout as TraceHeader in test.cpp: magic, version, key bytes, count, then int32 keys.
+def write_binary_trace(seq, output_file):
+    keys = array("i", seq)
+    if keys.itemsize != 4:
+        raise ValueError("int32 array type required")
+    with open(output_file, "wb") as f:
+        f.write(struct.pack("<8sIIQ", b"BSTTRACE", 1, 4, len(keys)))
+        f.write(keys.tobytes())
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="BST Test Sequence Generator")
     parser.add_argument(
@@ -71,6 +103,7 @@ if __name__ == "__main__":
             "hotspot",
             "zigzag",
             "bit_reversal",
+            "churn",
         ],
         required=True,
     )
@@ -78,6 +111,9 @@ if __name__ == "__main__":
     parser.add_argument("--output", type=str, default="sequence.txt")
     parser.add_argument("--hotspots", type=int, default=5)
     parser.add_argument("--ratio", type=float, default=0.8)
+    parser.add_argument("--insert-ratio", type=float, default=0.25)
+    parser.add_argument("--delete-ratio", type=float, default=0.25)
+    parser.add_argument("--binary", action="store_true", help="write a binary trace for test.cpp")
 
     args = parser.parse_args()
 
@@ -96,8 +132,15 @@ if __name__ == "__main__":
         seq = generate_zigzag(args.size)
     elif args.type == "bit_reversal":
         seq = generate_bit_reversal(args.size)
+    elif args.type == "churn":
+        seq = generate_churn(args.size, args.insert_ratio, args.delete_ratio)
     else:
         raise ValueError("Unsupported sequence type")
 
-    write_sequence_to_file(seq, args.output)
+    if args.type == "churn":
+        write_operations_to_file(seq, args.output)
+    elif args.binary:
+        write_binary_trace(seq, args.output)
+    else:
+        write_sequence_to_file(seq, args.output)
     print(f"[OK] Sequence ({args.type}) of size {args.size} written to {args.output}")
@@ -2,501 +2,4838 @@
 #include <vector>
 #include <chrono>
 #include <fstream>
-#include <unordered_map>
-#include <unordered_set>
 #include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include <random>
+#include <cstring>
+#include <mutex>
+#include <functional>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
-struct BSTMetrics
+// Counter for the no-op metrics policy: updates compile away and it reads as 0.
+struct NullCounter
 {
-    int total_comparisons = 0;
-    int total_rotations = 0;
+    NullCounter &operator++() { return *this; }
+    NullCounter operator++(int) { return *this; }
+    NullCounter &operator+=(int64_t) { return *this; }
+    operator int64_t() const { return 0; }
+};
+
+// Hardware event counts of one timed loop, -1 where a counter was not available.
+struct HardwareCounts
+{
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        BRANCH_MISSES,
+        DTLB_MISSES,
+        EVENTS
+    };
+    static constexpr const char *NAMES[EVENTS] = {"Cycles", "Instructions", "L1DMisses", "LLCMisses", "BranchMisses", "DTLBMisses"};
+
+    int64_t count[EVENTS] = {-1, -1, -1, -1, -1, -1};
+
+    bool available() const
+    {
+        return any_of(begin(count), end(count), [](int64_t c) { return c >= 0; });
+    }
+};
+
+// Metrics policy the trees are templated on. BSTMetrics counts with 64-bit
+// counters; NoMetrics leaves the bare algorithm for timing runs.
+template <typename Counter>
+struct MetricsPolicy
+{
+    Counter total_comparisons{};
+    Counter total_rotations{};
+    Counter total_node_visits{}; // only counted by trees whose nodes hold several keys
+    Counter total_path_switches{}; // auxiliary trees joined into the top path, by the path-based trees
     double total_time = 0.0;
+    double bytes_per_node = 0.0;
+    HardwareCounts hardware;
 };
 
-struct hash_pair
+using BSTMetrics = MetricsPolicy<int64_t>;
+using NoMetrics = MetricsPolicy<NullCounter>;
+
+// Node store shared by the tree classes. Nodes live in fixed-size contiguous slabs
+// and are addressed by 32-bit indices, so child links take half the space of
+// pointers and stay valid while the pool grows. Released nodes are reused by later
+// allocations; all slabs are freed together when the pool is destroyed.
+template <typename T>
+class NodePool
 {
-    size_t operator()(const pair<int, int> &p) const
+public:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    NodePool() { clear(); }
+
+    T &operator[](uint32_t i) { return slabs[i >> SLAB_BITS][i & SLAB_MASK]; }
+    const T &operator[](uint32_t i) const { return slabs[i >> SLAB_BITS][i & SLAB_MASK]; }
+
+    template <typename... Args>
+    uint32_t alloc(Args &&...args)
+    {
+        uint32_t i;
+        if (!freeList.empty())
+        {
+            i = freeList.back();
+            freeList.pop_back();
+        }
+        else
+        {
+            if ((next >> SLAB_BITS) == slabs.size())
+                slabs.push_back(make_unique<T[]>(SLAB_SIZE));
+            i = next++;
+        }
+        (*this)[i] = T(std::forward<Args>(args)...);
+        return i;
+    }
+
+    void release(uint32_t i) { freeList.push_back(i); }
+
+    void clear()
     {
+        slabs.clear();
+        freeList.clear();
+        next = 0;
+    }
+
+    size_t size() const { return next - freeList.size(); }
 
-        return hash<int>()(p.first) ^ hash<int>()(p.second);
+    // Bytes held by the slabs per live node, including the unused tail of the last slab.
+    double bytesPerNode() const
+    {
+        return size() ? static_cast<double>(slabs.size() * SLAB_SIZE * sizeof(T)) / size() : 0.0;
     }
+
+private:
+    static constexpr uint32_t SLAB_BITS = 14;
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+    static constexpr uint32_t SLAB_MASK = SLAB_SIZE - 1;
+
+    vector<unique_ptr<T[]>> slabs;
+    vector<uint32_t> freeList;
+    uint32_t next;
 };
 
+constexpr uint32_t NIL = NodePool<int>::NIL;
+
+// Read-only view of a run of keys, so that a trace can be passed around without
+// copying it, whether it lives in a vector or in a mapped file.
+struct KeySpan
+{
+    const int *first;
+    size_t count;
+
+    KeySpan(const int *f, size_t n) : first(f), count(n) {}
+    KeySpan(const vector<int> &keys) : first(keys.data()), count(keys.size()) {}
+
+    const int *begin() const { return first; }
+    const int *end() const { return first + count; }
+    size_t size() const { return count; }
+};
+
+// Number of lookups a batched search keeps in flight.
+constexpr size_t BATCH_GROUP = 16;
+
+enum BatchStep
+{
+    STEP_MORE,
+    STEP_FOUND,
+    STEP_MISSING
+};
+
+// Runs the lookups of a batch interleaved (AMAC style): up to BATCH_GROUP lookups
+// take turns advancing one node each, and every step prefetches the node its
+// lookup moves to, so the cache misses of the group overlap instead of stalling one
+// after another. A lookup that ends hands its slot to the next key. start(key)
+// gives the position of a new lookup and step(key, position) visits the node at
+// position and moves it on.
+template <typename Position, typename Start, typename Step>
+void interleaveLookups(KeySpan keys, bool *out, Start start, Step step)
+{
+    Position position[BATCH_GROUP];
+    size_t index[BATCH_GROUP];
+    size_t next = 0, active = 0;
+    for (; active < BATCH_GROUP && next < keys.size(); active++, next++)
+    {
+        index[active] = next;
+        position[active] = start(keys.first[next]);
+    }
+
+    while (active > 0)
+    {
+        for (size_t s = 0; s < active;)
+        {
+            BatchStep result = step(keys.first[index[s]], position[s]);
+            if (result == STEP_MORE)
+            {
+                s++;
+                continue;
+            }
+            out[index[s]] = (result == STEP_FOUND);
+            if (next < keys.size())
+            {
+                index[s] = next;
+                position[s] = start(keys.first[next++]);
+                s++;
+            }
+            else
+            {
+                active--;
+                index[s] = index[active];
+                position[s] = position[active];
+            }
+        }
+    }
+}
+
+// Adds one to count[d] for every node at depth d of the binary tree under root.
+// left(n) and right(n) give a node's children, none stands for a missing one.
+template <typename Link, typename Left, typename Right>
+void countDepths(Link root, Link none, Left left, Right right, vector<uint64_t> &count)
+{
+    vector<pair<Link, size_t>> stack;
+    if (root != none)
+        stack.push_back({root, 0});
+    while (!stack.empty())
+    {
+        Link n = stack.back().first;
+        size_t d = stack.back().second;
+        stack.pop_back();
+        if (d >= count.size())
+            count.resize(d + 1);
+        count[d]++;
+        if (left(n) != none)
+            stack.push_back({left(n), d + 1});
+        if (right(n) != none)
+            stack.push_back({right(n), d + 1});
+    }
+}
+
+// Common interface of the trees. The runner instantiates the concrete (final)
+// tree types directly, so its calls are resolved statically.
+template <typename Metrics = BSTMetrics>
 class BST
 {
 public:
-    BSTMetrics metrics;
+    Metrics metrics;
     virtual void insert(int key) = 0;
     virtual bool search(int key) = 0;
     virtual void remove(int key) = 0;
+    virtual double bytesPerNode() const { return 0.0; }
+
+    // Sets out[i] to whether keys[i] is present. Trees that can run lookups side by
+    // side override this; the others search one key after another, in order.
+    virtual void searchBatch(KeySpan keys, bool *out)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+            out[i] = search(keys.first[i]);
+    }
+
+    // Ordered queries. successor and predecessor store the nearest key above or
+    // below key in *out and return whether there is one; rangeScan calls visit on
+    // each key in [lo, hi] in increasing order and returns how many there were.
+    // Trees that keep no usable order report nothing.
+    virtual bool successor(int, int *) { return false; }
+    virtual bool predecessor(int, int *) { return false; }
+    virtual size_t rangeScan(int, int, const function<void(int)> &) { return 0; }
+
+    // Histogram of node depths in the current shape, for the trace snapshots. Trees
+    // whose shape is not a plain binary tree leave count empty.
+    virtual void nodeDepths(vector<uint64_t> &) {}
+
+    // Finishes construction that the tree otherwise defers to its first query, so
+    // that the runners can pay for it before the clock starts.
+    virtual void prepare() {}
     virtual ~BST() {}
 };
 
-class SplayTree : public BST
+// When a SplayTree restructures on a search. Inserts and removals always splay.
+enum SplayMode
+{
+    SPLAY_FULL,    // top-down splay of every accessed node to the root
+    SPLAY_SEMI,    // semi-splay: a zig-zig step rotates only the parent, about halving the path
+    SPLAY_DEPTH,   // splay only accesses deeper than twice the balanced height
+    SPLAY_EVERY_K, // splay every k-th search
+    SPLAY_RANDOM   // splay each search with probability 1/k
+};
+
+template <typename Metrics = BSTMetrics>
+class SplayTree final : public BST<Metrics>
 {
+public:
+    using BST<Metrics>::metrics;
+
 private:
     struct Node
     {
         int key;
-        Node *left;
-        Node *right;
-        Node(int k) : key(k), left(nullptr), right(nullptr) {}
+        uint32_t left;
+        uint32_t right;
+        Node(int k = 0) : key(k), left(NIL), right(NIL) {}
     };
 
-    Node *root;
+    NodePool<Node> pool;
+    uint32_t root;
+    SplayMode mode;
+    uint32_t k;
+    uint64_t searches = 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ull; // xorshift state of SPLAY_RANDOM
+    vector<uint32_t> path;                // root-to-node path of the variant searches
+    vector<uint32_t> pending;             // in-order walk stack of rangeScan
 
-    Node *rotateRight(Node *x)
+    Node &at(uint32_t i) { return pool[i]; }
+
+    uint32_t rotateRight(uint32_t x)
     {
-        Node *y = x->left;
-        x->left = y->right;
-        y->right = x;
+        uint32_t y = at(x).left;
+        at(x).left = at(y).right;
+        at(y).right = x;
         metrics.total_rotations++;
         return y;
     }
 
-    Node *rotateLeft(Node *x)
+    uint32_t rotateLeft(uint32_t x)
     {
-        Node *y = x->right;
-        x->right = y->left;
-        y->left = x;
+        uint32_t y = at(x).right;
+        at(x).right = at(y).left;
+        at(y).left = x;
         metrics.total_rotations++;
         return y;
     }
 
-    Node *splay(Node *node, int key)
+    // Top-down splay (Sleator-Tarjan). Nodes passed on the way down are hung on a
+    // left and a right assembly tree, which become the subtrees of the new root.
+    // Each zig, zig-zig and zig-zag step counts the rotations its recursive
+    // counterpart performs, and the same key comparisons are counted.
+    uint32_t splay(uint32_t node, int key)
     {
-        if (!node || node->key == key)
-        {
+        if (node == NIL)
             return node;
-        }
 
-        metrics.total_comparisons++;
+        uint32_t leftRoot = NIL, leftMax = NIL;
+        uint32_t rightRoot = NIL, rightMin = NIL;
 
-        if (key < node->key)
+        auto linkLeft = [&](uint32_t n)
+        {
+            if (leftMax == NIL)
+                leftRoot = n;
+            else
+                at(leftMax).right = n;
+            leftMax = n;
+            metrics.total_rotations++;
+        };
+        auto linkRight = [&](uint32_t n)
         {
-            if (!node->left)
-                return node;
+            if (rightMin == NIL)
+                rightRoot = n;
+            else
+                at(rightMin).left = n;
+            rightMin = n;
+            metrics.total_rotations++;
+        };
 
+        while (at(node).key != key)
+        {
             metrics.total_comparisons++;
-            if (key < node->left->key)
+
+            if (key < at(node).key)
             {
+                uint32_t l = at(node).left;
+                if (l == NIL)
+                    break;
 
-                node->left->left = splay(node->left->left, key);
-                node = rotateRight(node);
+                metrics.total_comparisons++;
+                if (key < at(l).key)
+                {
+                    node = rotateRight(node);
+                    if (at(node).left == NIL)
+                        break;
+                    linkRight(node);
+                    node = at(node).left;
+                }
+                else if (key > at(l).key && at(l).right != NIL)
+                {
+                    linkRight(node);
+                    linkLeft(l);
+                    node = at(l).right;
+                }
+                else
+                {
+                    linkRight(node);
+                    node = l;
+                    break;
+                }
             }
-            else if (key > node->left->key)
+            else
             {
+                uint32_t r = at(node).right;
+                if (r == NIL)
+                    break;
 
-                node->left->right = splay(node->left->right, key);
-                if (node->left->right)
-                    node->left = rotateLeft(node->left);
+                metrics.total_comparisons++;
+                if (key > at(r).key)
+                {
+                    node = rotateLeft(node);
+                    if (at(node).right == NIL)
+                        break;
+                    linkLeft(node);
+                    node = at(node).right;
+                }
+                else if (key < at(r).key && at(r).left != NIL)
+                {
+                    linkLeft(node);
+                    linkRight(r);
+                    node = at(r).left;
+                }
+                else
+                {
+                    linkLeft(node);
+                    node = r;
+                    break;
+                }
             }
-            return (node->left) ? rotateRight(node) : node;
         }
-        else
+
+        if (leftMax != NIL)
+        {
+            at(leftMax).right = at(node).left;
+            at(node).left = leftRoot;
+        }
+        if (rightMin != NIL)
         {
-            if (!node->right)
-                return node;
+            at(rightMin).left = at(node).right;
+            at(node).right = rightRoot;
+        }
+        return node;
+    }
 
-            metrics.total_comparisons++;
-            if (key > node->right->key)
-            {
+    // The link that points at path[i].
+    uint32_t &linkTo(size_t i)
+    {
+        if (i == 0)
+            return root;
+        Node &parent = at(path[i - 1]);
+        return (parent.left == path[i]) ? parent.left : parent.right;
+    }
+
+    // Rotates path[i] above its parent path[i - 1].
+    void rotateUp(size_t i)
+    {
+        uint32_t &link = linkTo(i - 1);
+        link = (at(path[i - 1]).left == path[i]) ? rotateRight(link) : rotateLeft(link);
+        path[i - 1] = path[i];
+    }
 
-                node->right->right = splay(node->right->right, key);
-                node = rotateLeft(node);
+    // Bottom-up splay of the last node on path. With semi set, a zig-zig step
+    // rotates only the parent above the grandparent and carries on from the
+    // parent, and the walk stops below the root instead of a final zig.
+    void splayPath(bool semi)
+    {
+        size_t i = path.size() - 1;
+        while (i >= 2)
+        {
+            bool zigZig = (at(path[i - 1]).left == path[i]) == (at(path[i - 2]).left == path[i - 1]);
+            if (zigZig && semi)
+            {
+                rotateUp(i - 1);
             }
-            else if (key < node->right->key)
+            else if (zigZig)
             {
-
-                node->right->left = splay(node->right->left, key);
-                if (node->right->left)
-                    node->right = rotateRight(node->right);
+                rotateUp(i - 1);
+                path[i - 1] = path[i];
+                rotateUp(i - 1);
+            }
+            else
+            {
+                rotateUp(i);
+                rotateUp(i - 1);
             }
-            return (node->right) ? rotateLeft(node) : node;
+            i -= 2;
+        }
+        if (i == 1 && !semi)
+            rotateUp(1);
+    }
+
+    // Search of the variant modes: a plain descent that records its path, then a
+    // bottom-up splay of the last node reached if the mode calls for one.
+    bool searchVariant(int key)
+    {
+        path.clear();
+        for (uint32_t curr = root; curr != NIL;)
+        {
+            metrics.total_comparisons++;
+            path.push_back(curr);
+            if (key == at(curr).key)
+                break;
+            curr = (key < at(curr).key) ? at(curr).left : at(curr).right;
+        }
+        if (path.empty())
+            return false;
+        bool found = at(path.back()).key == key;
+
+        bool restructure = true;
+        if (mode == SPLAY_DEPTH)
+        {
+            size_t n = pool.size();
+            restructure = path.size() - 1 > 2 * static_cast<size_t>(64 - __builtin_clzll(n));
+        }
+        else if (mode == SPLAY_EVERY_K)
+        {
+            restructure = ++searches % k == 0;
         }
+        else if (mode == SPLAY_RANDOM)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            restructure = rng % k == 0;
+        }
+        if (restructure)
+            splayPath(mode == SPLAY_SEMI);
+        return found;
     }
 
 public:
-    SplayTree() : root(nullptr) {}
+    // k is the period of SPLAY_EVERY_K and SPLAY_RANDOM; the other modes ignore it.
+    SplayTree(SplayMode m = SPLAY_FULL, uint32_t period = 8) : root(NIL), mode(m), k(max(period, 1u)) {}
 
     void insert(int key) override
     {
-        if (!root)
+        if (root == NIL)
         {
-            root = new Node(key);
+            root = pool.alloc(key);
             return;
         }
         root = splay(root, key);
-        if (key == root->key)
+        if (key == at(root).key)
             return;
 
-        Node *newNode = new Node(key);
-        if (key < root->key)
+        uint32_t newNode = pool.alloc(key);
+        if (key < at(root).key)
         {
-            newNode->right = root;
-            newNode->left = root->left;
-            root->left = nullptr;
+            at(newNode).right = root;
+            at(newNode).left = at(root).left;
+            at(root).left = NIL;
         }
         else
         {
-            newNode->left = root;
-            newNode->right = root->right;
-            root->right = nullptr;
+            at(newNode).left = root;
+            at(newNode).right = at(root).right;
+            at(root).right = NIL;
         }
         root = newNode;
     }
 
     bool search(int key) override
     {
+        if (mode != SPLAY_FULL)
+            return searchVariant(key);
         root = splay(root, key);
-        return (root && root->key == key);
+        return (root != NIL && at(root).key == key);
     }
 
-    void remove(int key) override {}
-};
-
-class BasicBST : public BST
-{
-private:
-    struct Node
+    // Splays key to the root, then joins its subtrees by splaying the maximum of the
+    // left subtree to its root, where it has no right child.
+    void remove(int key) override
     {
-        int key;
-        Node *left;
-        Node *right;
-        Node(int k) : key(k), left(nullptr), right(nullptr) {}
-    };
+        if (root == NIL)
+            return;
+        root = splay(root, key);
+        if (at(root).key != key)
+            return;
 
-    Node *root;
+        uint32_t old = root;
+        if (at(old).left == NIL)
+            root = at(old).right;
+        else
+        {
+            root = splay(at(old).left, key);
+            at(root).right = at(old).right;
+        }
+        pool.release(old);
+    }
 
-    Node *insert(Node *node, int key)
+    // The ordered queries always splay, whatever the mode. When key is absent and
+    // the splay stops at its predecessor, the successor is the minimum of the right
+    // subtree: splaying key there brings it up with no left child, and one rotation
+    // makes it the root.
+    bool successor(int key, int *out) override
     {
-        if (!node)
-            return new Node(key);
+        if (root == NIL)
+            return false;
+        root = splay(root, key);
         metrics.total_comparisons++;
-        if (key < node->key)
-            node->left = insert(node->left, key);
-        else
-            node->right = insert(node->right, key);
-        return node;
+        if (at(root).key <= key)
+        {
+            if (at(root).right == NIL)
+                return false;
+            at(root).right = splay(at(root).right, key);
+            root = rotateLeft(root);
+        }
+        *out = at(root).key;
+        return true;
     }
 
-    bool search(Node *node, int key)
+    bool predecessor(int key, int *out) override
     {
-        if (!node)
+        if (root == NIL)
             return false;
+        root = splay(root, key);
         metrics.total_comparisons++;
-        if (key == node->key)
-            return true;
-        if (key < node->key)
-            return search(node->left, key);
-        return search(node->right, key);
+        if (at(root).key >= key)
+        {
+            if (at(root).left == NIL)
+                return false;
+            at(root).left = splay(at(root).left, key);
+            root = rotateRight(root);
+        }
+        *out = at(root).key;
+        return true;
     }
 
-public:
-    BasicBST() : root(nullptr) {}
-
-    void insert(int key) override
+    // Splays lo to the root and then hi to the root of the right subtree. The keys
+    // strictly between the two nodes form the left subtree of the second, which is
+    // walked without comparisons, so a scan costs two splays plus its output.
+    size_t rangeScan(int lo, int hi, const function<void(int)> &visit) override
     {
-        root = insert(root, key);
+        if (root == NIL || lo > hi)
+            return 0;
+        root = splay(root, lo);
+        size_t count = 0;
+        metrics.total_comparisons++;
+        if (at(root).key > hi)
+            return 0;
+        if (at(root).key >= lo)
+        {
+            visit(at(root).key);
+            count++;
+        }
+
+        uint32_t upper = at(root).right;
+        if (upper == NIL)
+            return count;
+        upper = at(root).right = splay(upper, hi);
+
+        pending.clear();
+        for (uint32_t n = at(upper).left; n != NIL; n = at(n).left)
+            pending.push_back(n);
+        while (!pending.empty())
+        {
+            uint32_t n = pending.back();
+            pending.pop_back();
+            visit(at(n).key);
+            count++;
+            for (uint32_t m = at(n).right; m != NIL; m = at(m).left)
+                pending.push_back(m);
+        }
+
+        metrics.total_comparisons++;
+        if (at(upper).key <= hi)
+        {
+            visit(at(upper).key);
+            count++;
+        }
+        return count;
     }
 
-    bool search(int key) override
+    void nodeDepths(vector<uint64_t> &count) override
     {
-        return search(root, key);
+        countDepths(root, NIL, [&](uint32_t n)
+        {
+            return at(n).left;
+        }, [&](uint32_t n)
+        {
+            return at(n).right;
+        }, count);
     }
 
-    void remove(int key) override {}
+    double bytesPerNode() const override { return pool.bytesPerNode(); }
 };
 
-struct ReferenceNode
+template <typename Metrics = BSTMetrics>
+class BasicBST final : public BST<Metrics>
 {
-    int key;
-    ReferenceNode *left;
-    ReferenceNode *right;
-    ReferenceNode *parent;
-    bool isPreferred;
+public:
+    using BST<Metrics>::metrics;
 
-    ReferenceNode(int k) : key(k), left(nullptr), right(nullptr), parent(nullptr), isPreferred(false) {}
-};
+private:
+    struct Node
+    {
+        int key;
+        uint32_t left;
+        uint32_t right;
+        Node(int k = 0) : key(k), left(NIL), right(NIL) {}
+    };
 
-class ReferenceTree
-{
-public:
-    ReferenceNode *root;
-    BSTMetrics metrics;
+    NodePool<Node> pool;
+    uint32_t root;
+    vector<uint32_t> pending; // in-order walk stack of rangeScan
+
+    Node &at(uint32_t i) { return pool[i]; }
 
-    ReferenceTree() : root(nullptr) {}
+public:
+    BasicBST() : root(NIL) {}
 
-    void insert(int key)
+    // Duplicate keys are ignored, matching the other trees, so that a remove
+    // after repeated inserts leaves the key absent.
+    void insert(int key) override
     {
-        if (!root)
-        {
-            root = new ReferenceNode(key);
-            return;
-        }
-        ReferenceNode *curr = root;
-        ReferenceNode *prev = nullptr;
-        while (curr)
+        uint32_t *link = &root;
+        while (*link != NIL)
         {
-            prev = curr;
-            if (key < curr->key)
-                curr = curr->left;
-            else
-                curr = curr->right;
+            metrics.total_comparisons++;
+            if (key == at(*link).key)
+                return;
+            link = (key < at(*link).key) ? &at(*link).left : &at(*link).right;
         }
-        ReferenceNode *newNode = new ReferenceNode(key);
-        if (key < prev->key)
-            prev->left = newNode;
-        else
-            prev->right = newNode;
-        newNode->parent = prev;
+        uint32_t newNode = pool.alloc(key);
+        *link = newNode;
     }
 
-    vector<ReferenceNode *> findPath(int key)
+    bool search(int key) override
     {
-        vector<ReferenceNode *> path;
-        ReferenceNode *curr = root;
-        while (curr)
+        uint32_t curr = root;
+        while (curr != NIL)
         {
             metrics.total_comparisons++;
-            path.push_back(curr);
-            if (key == curr->key)
-                break;
-            curr = (key < curr->key) ? curr->left : curr->right;
+            if (key == at(curr).key)
+                return true;
+            curr = (key < at(curr).key) ? at(curr).left : at(curr).right;
         }
-        return path;
+        return false;
     }
 
-    void inorderTraversal(ReferenceNode *node)
+    void searchBatch(KeySpan keys, bool *out) override
     {
-        if (!node)
-            return;
-        inorderTraversal(node->left);
-        cout << node->key << " ";
-        inorderTraversal(node->right);
+        interleaveLookups<uint32_t>(keys, out, [&](int)
+        {
+            return root;
+        }, [&](int key, uint32_t &curr)
+        {
+            if (curr == NIL)
+                return STEP_MISSING;
+            metrics.total_comparisons++;
+            const Node &node = at(curr);
+            if (node.key == key)
+                return STEP_FOUND;
+            curr = (key < node.key) ? node.left : node.right;
+            if (curr == NIL)
+                return STEP_MISSING;
+            __builtin_prefetch(&at(curr));
+            return STEP_MORE;
+        });
     }
 
-    void printInorder()
+    // A node with two children is replaced by its in-order successor.
+    void remove(int key) override
     {
-        inorderTraversal(root);
-        cout << endl;
-    }
-};
+        uint32_t *link = &root;
+        while (*link != NIL)
+        {
+            metrics.total_comparisons++;
+            if (key == at(*link).key)
+                break;
+            link = (key < at(*link).key) ? &at(*link).left : &at(*link).right;
+        }
+        uint32_t node = *link;
+        if (node == NIL)
+            return;
 
-class TangoTree : public BST
-{
-private:
-    ReferenceTree refTree;
+        if (at(node).left == NIL)
+            *link = at(node).right;
+        else if (at(node).right == NIL)
+            *link = at(node).left;
+        else
+        {
+            uint32_t *succLink = &at(node).right;
+            while (at(*succLink).left != NIL)
+                succLink = &at(*succLink).left;
+            uint32_t succ = *succLink;
+            *succLink = at(succ).right;
+            at(succ).left = at(node).left;
+            at(succ).right = at(node).right;
+            *link = succ;
+        }
+        pool.release(node);
+    }
 
-public:
-    void insert(int key) override
+    bool successor(int key, int *out) override
     {
-        refTree.insert(key);
+        uint32_t best = NIL;
+        for (uint32_t curr = root; curr != NIL;)
+        {
+            metrics.total_comparisons++;
+            if (at(curr).key > key)
+            {
+                best = curr;
+                curr = at(curr).left;
+            }
+            else
+                curr = at(curr).right;
+        }
+        if (best != NIL)
+            *out = at(best).key;
+        return best != NIL;
     }
 
-    bool search(int key) override
+    bool predecessor(int key, int *out) override
     {
-
-        refTree.metrics = BSTMetrics();
-        auto path = refTree.findPath(key);
-        if (path.empty())
-            return false;
-
-        ReferenceNode *preferredRoot = nullptr;
-        for (ReferenceNode *node : path)
+        uint32_t best = NIL;
+        for (uint32_t curr = root; curr != NIL;)
         {
-            if (node->isPreferred)
+            metrics.total_comparisons++;
+            if (at(curr).key < key)
             {
-                preferredRoot = node;
-                break;
+                best = curr;
+                curr = at(curr).right;
             }
+            else
+                curr = at(curr).left;
         }
+        if (best != NIL)
+            *out = at(best).key;
+        return best != NIL;
+    }
 
-        if (!preferredRoot)
-            preferredRoot = path.front();
-
-        bool needRebuild = false;
-        for (ReferenceNode *node : path)
+    // Stacks the nodes >= lo on the search path for lo, then walks in order from
+    // there until a key passes hi.
+    size_t rangeScan(int lo, int hi, const function<void(int)> &visit) override
+    {
+        pending.clear();
+        for (uint32_t curr = root; curr != NIL;)
         {
-            if (!node->isPreferred)
+            metrics.total_comparisons++;
+            if (at(curr).key >= lo)
             {
-                node->isPreferred = true;
-                needRebuild = true;
+                pending.push_back(curr);
+                curr = at(curr).left;
             }
+            else
+                curr = at(curr).right;
         }
-        if (needRebuild)
+
+        size_t count = 0;
+        while (!pending.empty())
         {
-            refTree.metrics.total_rotations++;
+            uint32_t n = pending.back();
+            pending.pop_back();
+            metrics.total_comparisons++;
+            if (at(n).key > hi)
+                break;
+            visit(at(n).key);
+            count++;
+            for (uint32_t m = at(n).right; m != NIL; m = at(m).left)
+                pending.push_back(m);
         }
-
-        metrics.total_comparisons += refTree.metrics.total_comparisons;
-        metrics.total_rotations += refTree.metrics.total_rotations;
-
-        return !path.empty() && (path.back()->key == key);
+        return count;
     }
 
-    void remove(int key) override {}
-};
+    void nodeDepths(vector<uint64_t> &count) override
+    {
+        countDepths(root, NIL, [&](uint32_t n)
+        {
+            return at(n).left;
+        }, [&](uint32_t n)
+        {
+            return at(n).right;
+        }, count);
+    }
+
+    double bytesPerNode() const override { return pool.bytesPerNode(); }
+};
+
+enum : uint8_t
+{
+    PREF_NONE,
+    PREF_LEFT, // the node itself or its left subtree
+    PREF_RIGHT
+};
+
+struct ReferenceNode
+{
+    int key;
+    uint32_t left;
+    uint32_t right;
+    uint32_t parent;
+    uint8_t preferred; // side of the most recent access in this subtree
+
+    ReferenceNode(int k = 0) : key(k), left(NIL), right(NIL), parent(NIL), preferred(PREF_NONE) {}
+};
+
+class ReferenceTree
+{
+public:
+    NodePool<ReferenceNode> nodes;
+    uint32_t root;
+    BSTMetrics metrics;
+    size_t size;
+
+    ReferenceTree() : root(NIL), size(0) {}
+
+    ReferenceNode &at(uint32_t i) { return nodes[i]; }
+
+    // Returns the new node, or NIL if key is already present.
+    uint32_t insert(int key)
+    {
+        if (root == NIL)
+        {
+            root = nodes.alloc(key);
+            size = 1;
+            return root;
+        }
+        uint32_t curr = root;
+        uint32_t prev = NIL;
+        while (curr != NIL)
+        {
+            prev = curr;
+            if (key == at(curr).key)
+                return NIL;
+            if (key < at(curr).key)
+                curr = at(curr).left;
+            else
+                curr = at(curr).right;
+        }
+        uint32_t newNode = nodes.alloc(key);
+        if (key < at(prev).key)
+            at(prev).left = newNode;
+        else
+            at(prev).right = newNode;
+        at(newNode).parent = prev;
+        size++;
+        return newNode;
+    }
+
+    // A node with two children takes over its successor's key, and the successor
+    // node is unlinked instead.
+    void remove(int key)
+    {
+        uint32_t node = root;
+        while (node != NIL && at(node).key != key)
+            node = (key < at(node).key) ? at(node).left : at(node).right;
+        if (node == NIL)
+            return;
+
+        if (at(node).left != NIL && at(node).right != NIL)
+        {
+            uint32_t succ = at(node).right;
+            while (at(succ).left != NIL)
+                succ = at(succ).left;
+            at(node).key = at(succ).key;
+            node = succ;
+        }
+
+        uint32_t child = (at(node).left != NIL) ? at(node).left : at(node).right;
+        uint32_t parent = at(node).parent;
+        if (child != NIL)
+            at(child).parent = parent;
+        if (parent == NIL)
+            root = child;
+        else if (at(parent).left == node)
+            at(parent).left = child;
+        else
+            at(parent).right = child;
+        nodes.release(node);
+        size--;
+    }
+
+    int depth(uint32_t node)
+    {
+        int d = 0;
+        for (node = at(node).parent; node != NIL; node = at(node).parent)
+            d++;
+        return d;
+    }
+
+    vector<uint32_t> findPath(int key)
+    {
+        vector<uint32_t> path;
+        uint32_t curr = root;
+        while (curr != NIL)
+        {
+            metrics.total_comparisons++;
+            path.push_back(curr);
+            if (key == at(curr).key)
+                break;
+            curr = (key < at(curr).key) ? at(curr).left : at(curr).right;
+        }
+        return path;
+    }
+
+    // Plain lookups of keys, interleaved; the preferred sides are left as they are.
+    void searchBatch(KeySpan keys, bool *out)
+    {
+        interleaveLookups<uint32_t>(keys, out, [&](int)
+        {
+            return root;
+        }, [&](int key, uint32_t &curr)
+        {
+            if (curr == NIL)
+                return STEP_MISSING;
+            metrics.total_comparisons++;
+            const ReferenceNode &node = at(curr);
+            if (node.key == key)
+                return STEP_FOUND;
+            curr = (key < node.key) ? node.left : node.right;
+            if (curr == NIL)
+                return STEP_MISSING;
+            __builtin_prefetch(&at(curr));
+            return STEP_MORE;
+        });
+    }
+
+    void inorderTraversal(uint32_t node)
+    {
+        if (node == NIL)
+            return;
+        inorderTraversal(at(node).left);
+        cout << at(node).key << " ";
+        inorderTraversal(at(node).right);
+    }
+
+    void printInorder()
+    {
+        inorderTraversal(root);
+        cout << endl;
+    }
+};
+
+template <typename Metrics = BSTMetrics>
+class TangoTree final : public BST<Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    // Every reference-tree node appears exactly once in the tango tree. Nodes on the
+    // same preferred path form one auxiliary red-black tree keyed by key and augmented
+    // with their reference-tree depth; the roots of other auxiliary trees hang off it
+    // as marked (isRoot) children and are treated as leaves of the current one.
+    // Removed keys stay in place as tombstones until they make up half the tree.
+    struct Node
+    {
+        int key;
+        int depth;    // depth in the reference tree, fixed once built
+        int minDepth; // depth range over this node's auxiliary subtree
+        int maxDepth;
+        Node *left;
+        Node *right;
+        bool black;
+        bool isRoot;
+        bool deleted;
+
+        Node(int k = 0, int d = 0) : key(k), depth(d), minDepth(d), maxDepth(d), left(nullptr), right(nullptr), black(true), isRoot(true), deleted(false) {}
+    };
+
+    struct Split
+    {
+        Node *left;
+        Node *mid;
+        Node *right;
+    };
+
+    ReferenceTree refTree;
+    NodePool<Node> pool;
+    Node *root = nullptr;
+    bool dirty = false;
+    size_t deadCount = 0;
+    vector<Node *> pending; // stack of the in-order walk
+
+    static bool isLeaf(Node *n) { return !n || n->isRoot; }
+    static bool isRed(Node *n) { return !isLeaf(n) && !n->black; }
+
+    static void pull(Node *n)
+    {
+        n->minDepth = n->maxDepth = n->depth;
+        if (!isLeaf(n->left))
+        {
+            n->minDepth = min(n->minDepth, n->left->minDepth);
+            n->maxDepth = max(n->maxDepth, n->left->maxDepth);
+        }
+        if (!isLeaf(n->right))
+        {
+            n->minDepth = min(n->minDepth, n->right->minDepth);
+            n->maxDepth = max(n->maxDepth, n->right->maxDepth);
+        }
+    }
+
+    static int blackHeight(Node *n)
+    {
+        int h = 0;
+        for (; !isLeaf(n); n = n->left)
+            h += n->black;
+        return h;
+    }
+
+    // Detaches a subtree as a standalone red-black tree.
+    static Node *asTree(Node *n)
+    {
+        if (isRed(n))
+            n->black = true;
+        return n;
+    }
+
+    Node *rotateLeft(Node *x)
+    {
+        Node *y = x->right;
+        x->right = y->left;
+        y->left = x;
+        pull(x);
+        pull(y);
+        metrics.total_rotations++;
+        return y;
+    }
+
+    Node *rotateRight(Node *x)
+    {
+        Node *y = x->left;
+        x->left = y->right;
+        y->right = x;
+        pull(x);
+        pull(y);
+        metrics.total_rotations++;
+        return y;
+    }
+
+    // Join of red-black trees l < k < r with black heights hl >= hr, descending the right spine of l.
+    Node *joinRight(Node *l, Node *k, Node *r, int hl, int hr)
+    {
+        if (hl == hr && !isRed(l))
+        {
+            k->left = l;
+            k->right = r;
+            k->black = false;
+            pull(k);
+            return k;
+        }
+        l->right = joinRight(l->right, k, r, hl - l->black, hr);
+        pull(l);
+        if (l->black && isRed(l->right) && isRed(l->right->right))
+        {
+            l->right->right->black = true;
+            return rotateLeft(l);
+        }
+        return l;
+    }
+
+    Node *joinLeft(Node *l, Node *k, Node *r, int hl, int hr)
+    {
+        if (hl == hr && !isRed(r))
+        {
+            k->left = l;
+            k->right = r;
+            k->black = false;
+            pull(k);
+            return k;
+        }
+        r->left = joinLeft(l, k, r->left, hl, hr - r->black);
+        pull(r);
+        if (r->black && isRed(r->left) && isRed(r->left->left))
+        {
+            r->left->left->black = true;
+            return rotateRight(r);
+        }
+        return r;
+    }
+
+    Node *join(Node *l, Node *k, Node *r)
+    {
+        int hl = blackHeight(l), hr = blackHeight(r);
+        Node *t = (hl >= hr) ? joinRight(l, k, r, hl, hr) : joinLeft(l, k, r, hl, hr);
+        t->black = true;
+        return t;
+    }
+
+    // Splits t around the node holding key, which must belong to t.
+    Split split(Node *t, int key)
+    {
+        metrics.total_comparisons++;
+        if (key == t->key)
+        {
+            Split s = {asTree(t->left), t, asTree(t->right)};
+            t->left = t->right = nullptr;
+            return s;
+        }
+        if (key < t->key)
+        {
+            Split s = split(t->left, key);
+            s.right = join(s.right, t, asTree(t->right));
+            return s;
+        }
+        Split s = split(t->right, key);
+        s.left = join(asTree(t->left), t, s.left);
+        return s;
+    }
+
+    Node *predecessor(Node *t, int key)
+    {
+        Node *best = nullptr;
+        while (!isLeaf(t))
+        {
+            metrics.total_comparisons++;
+            if (t->key < key)
+            {
+                best = t;
+                t = t->right;
+            }
+            else
+                t = t->left;
+        }
+        return best;
+    }
+
+    Node *successor(Node *t, int key)
+    {
+        Node *best = nullptr;
+        while (!isLeaf(t))
+        {
+            metrics.total_comparisons++;
+            if (t->key > key)
+            {
+                best = t;
+                t = t->left;
+            }
+            else
+                t = t->right;
+        }
+        return best;
+    }
+
+    // Leftmost / rightmost node of the auxiliary tree whose depth exceeds d.
+    Node *deepLeftmost(Node *t, int d)
+    {
+        while (true)
+        {
+            metrics.total_comparisons++;
+            if (!isLeaf(t->left) && t->left->maxDepth > d)
+                t = t->left;
+            else if (t->depth > d)
+                return t;
+            else
+                t = t->right;
+        }
+    }
+
+    Node *deepRightmost(Node *t, int d)
+    {
+        while (true)
+        {
+            metrics.total_comparisons++;
+            if (!isLeaf(t->right) && t->right->maxDepth > d)
+                t = t->right;
+            else if (t->depth > d)
+                return t;
+            else
+                t = t->left;
+        }
+    }
+
+    // Splits out the part of t strictly between lo and hi (null means unbounded) and
+    // flips it: an auxiliary subtree is cut off as its own auxiliary tree, while a
+    // hanging auxiliary tree is merged into t. The pieces are then concatenated back.
+    Node *toggleGap(Node *t, Node *lo, Node *hi)
+    {
+        Node *left = nullptr, *mid = t, *right = nullptr;
+        if (lo)
+        {
+            Split s = split(mid, lo->key);
+            left = s.left;
+            mid = s.right;
+        }
+        if (hi)
+        {
+            Split s = split(mid, hi->key);
+            mid = s.left;
+            right = s.right;
+        }
+        if (mid)
+        {
+            if (mid->isRoot)
+                mid->isRoot = false;
+            else
+                mid->isRoot = true;
+        }
+        if (hi)
+            mid = join(mid, hi, right);
+        if (lo)
+            mid = join(left, lo, mid);
+        return mid;
+    }
+
+    // Cuts the preferred path stored in t below reference depth d.
+    Node *cut(Node *t, int d)
+    {
+        if (t->maxDepth <= d)
+            return t;
+        Node *l = deepLeftmost(t, d);
+        Node *r = deepRightmost(t, d);
+        return toggleGap(t, predecessor(t, l->key), successor(t, r->key));
+    }
+
+    // Joins the auxiliary tree hanging at aux into the path stored in t.
+    Node *link(Node *t, Node *aux)
+    {
+        return toggleGap(t, predecessor(t, aux->key), successor(t, aux->key));
+    }
+
+    // Initially every reference node is its own preferred path, so the tango
+    // tree starts out with the shape of the reference tree. Auxiliary nodes come
+    // from the shared slab pool but keep pointer links: split and join chase
+    // links far more often than they store them, and the index form measured
+    // noticeably slower here.
+    void build()
+    {
+        dirty = false;
+        deadCount = 0;
+        pool.clear();
+        root = nullptr;
+        if (refTree.root == NIL)
+            return;
+
+        struct Frame
+        {
+            uint32_t ref;
+            Node **slot;
+            int depth;
+        };
+        vector<Frame> stack = {{refTree.root, &root, 0}};
+        while (!stack.empty())
+        {
+            Frame f = stack.back();
+            stack.pop_back();
+            const ReferenceNode &r = refTree.at(f.ref);
+            Node *n = &pool[pool.alloc(r.key, f.depth)];
+            *f.slot = n;
+            if (r.left != NIL)
+                stack.push_back({r.left, &n->left, f.depth + 1});
+            if (r.right != NIL)
+                stack.push_back({r.right, &n->right, f.depth + 1});
+        }
+    }
+
+    // Ordinary BST descent over the whole tango tree, crossing auxiliary tree
+    // boundaries. Returns the node holding key, or the slot where it would hang.
+    Node **locate(int key)
+    {
+        Node **slot = &root;
+        while (*slot && (*slot)->key != key)
+        {
+            metrics.total_comparisons++;
+            slot = (key < (*slot)->key) ? &(*slot)->left : &(*slot)->right;
+        }
+        return slot;
+    }
+
+    // Physically removes the tombstoned keys from the reference tree; the tango
+    // tree is rebuilt on the next access.
+    void purge()
+    {
+        vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *n = stack.back();
+            stack.pop_back();
+            if (!n)
+                continue;
+            if (n->deleted)
+                refTree.remove(n->key);
+            stack.push_back(n->left);
+            stack.push_back(n->right);
+        }
+        dirty = true;
+    }
+
+    // In-order walk of the whole tango tree, across auxiliary tree boundaries, from
+    // the first key past key (or at it, if inclusive) upwards, or downwards unless
+    // ascending. Tombstones are skipped; the walk stops when visit returns false.
+    template <typename F>
+    void walk(int key, bool inclusive, bool ascending, F visit)
+    {
+        auto toward = [&](Node *n)
+        {
+            return ascending ? n->left : n->right;
+        };
+        auto away = [&](Node *n)
+        {
+            return ascending ? n->right : n->left;
+        };
+
+        pending.clear();
+        for (Node *n = root; n;)
+        {
+            metrics.total_comparisons++;
+            bool past = ascending ? n->key > key : n->key < key;
+            if (past || (inclusive && n->key == key))
+            {
+                pending.push_back(n);
+                n = toward(n);
+            }
+            else
+                n = away(n);
+        }
+        while (!pending.empty())
+        {
+            Node *n = pending.back();
+            pending.pop_back();
+            if (!n->deleted && !visit(n))
+                return;
+            for (Node *m = away(n); m; m = toward(m))
+                pending.push_back(m);
+        }
+    }
+
+    // Finds the nearest live key on one side of key and then accesses it, so that
+    // the query reshapes the preferred paths like a search for its answer.
+    bool neighbour(int key, bool ascending, int *out)
+    {
+        if (dirty)
+            build();
+        Node *found = nullptr;
+        walk(key, false, ascending, [&](Node *n)
+        {
+            found = n;
+            return false;
+        });
+        if (!found)
+            return false;
+        *out = found->key;
+        access(found->key);
+        return true;
+    }
+
+    // Runs the tango access for key and returns the last node reached.
+    Node *access(int key)
+    {
+        if (dirty)
+            build();
+        if (!root)
+            return nullptr;
+
+        Node *v = root;
+        while (true)
+        {
+            metrics.total_comparisons++;
+            if (key == v->key)
+                break;
+            Node *c = (key < v->key) ? v->left : v->right;
+            if (!c)
+                break;
+            if (c->isRoot)
+            {
+                metrics.total_path_switches++;
+                // Entering another preferred path: the path of the top tree now turns
+                // towards c at depth minDepth - 1, so cut it there and absorb c's tree.
+                root->isRoot = false;
+                root = link(cut(root, c->minDepth - 1), c);
+                root->isRoot = true;
+                v = root;
+                continue;
+            }
+            v = c;
+        }
+
+        // The accessed node has no preferred child afterwards.
+        root->isRoot = false;
+        root = cut(root, v->depth);
+        root->isRoot = true;
+        return v;
+    }
+
+public:
+    void prepare() override
+    {
+        if (dirty)
+            build();
+    }
+
+    // Before the first access, keys only go into the reference tree. Afterwards a
+    // new key becomes a leaf of the reference tree and therefore a one-node
+    // preferred path, hung at its BST position in the tango tree.
+    void insert(int key) override
+    {
+        uint32_t ref = refTree.insert(key);
+        if (dirty || !root)
+        {
+            dirty = true;
+            return;
+        }
+
+        Node **slot = locate(key);
+        if (*slot)
+        {
+            if ((*slot)->deleted)
+            {
+                (*slot)->deleted = false;
+                deadCount--;
+            }
+            return;
+        }
+        *slot = &pool[pool.alloc(key, refTree.depth(ref))];
+    }
+
+    bool search(int key) override
+    {
+        Node *v = access(key);
+        return v && v->key == key && !v->deleted;
+    }
+
+    // Removal accesses the key like a search and leaves a tombstone; the reference
+    // tree is rebuilt without them once they outnumber the live keys.
+    void remove(int key) override
+    {
+        if (dirty)
+        {
+            refTree.remove(key);
+            return;
+        }
+        Node *v = access(key);
+        if (!v || v->key != key || v->deleted)
+            return;
+        v->deleted = true;
+        if (++deadCount * 2 > refTree.size)
+            purge();
+    }
+
+    bool successor(int key, int *out) override { return neighbour(key, true, out); }
+    bool predecessor(int key, int *out) override { return neighbour(key, false, out); }
+
+    // Accesses lo, then reads the keys in range off an in-order walk without
+    // touching the preferred paths further.
+    size_t rangeScan(int lo, int hi, const function<void(int)> &visit) override
+    {
+        if (lo > hi)
+            return 0;
+        access(lo);
+        size_t count = 0;
+        walk(lo, true, true, [&](Node *n)
+        {
+            metrics.total_comparisons++;
+            if (n->key > hi)
+                return false;
+            visit(n->key);
+            count++;
+            return true;
+        });
+        return count;
+    }
+
+    // Depths in the tango tree itself, across the auxiliary trees.
+    void nodeDepths(vector<uint64_t> &count) override
+    {
+        if (dirty)
+            build();
+        countDepths(root, static_cast<Node *>(nullptr), [](Node *n)
+        {
+            return n->left;
+        }, [](Node *n)
+        {
+            return n->right;
+        }, count);
+    }
+
+    double bytesPerNode() const override
+    {
+        return pool.bytesPerNode() + refTree.nodes.bytesPerNode();
+    }
+};
+
+// Multi-splay tree (Wang, Derryberry, Sleator). Like TangoTree it stores each
+// preferred path of the reference tree as an auxiliary tree, with the roots of the
+// other auxiliary trees hanging off it as marked (isRoot) children, but the
+// auxiliary trees are splay trees with no augmentation. Changing the preferred
+// child of u takes three splays: u to the root of its auxiliary tree, then the
+// nearest shallower path node on either side of u, l and r, to u's children.
+// Everything between l and u is then u's left reference subtree and everything
+// between u and r its right one, so the switch flips the isRoot marks of l's right
+// and r's left child. Switches are made top-down as the access descends, as in
+// TangoTree, and finally the accessed node is splayed to the root and left without
+// a preferred child. Removed keys stay in place as tombstones until they make up
+// half the tree.
+template <typename Metrics = BSTMetrics>
+class MultiSplayTree final : public BST<Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    struct Node
+    {
+        int key;
+        int depth; // depth in the reference tree, fixed once built
+        uint32_t left;
+        uint32_t right;
+        bool isRoot;
+        bool deleted;
+
+        Node(int k = 0, int d = 0) : key(k), depth(d), left(NIL), right(NIL), isRoot(true), deleted(false) {}
+    };
+
+    ReferenceTree refTree;
+    NodePool<Node> pool;
+    uint32_t root = NIL;
+    bool dirty = false;
+    size_t deadCount = 0;
+
+    Node &at(uint32_t i) { return pool[i]; }
+    bool isLeaf(uint32_t n) { return n == NIL || at(n).isRoot; }
+
+    uint32_t rotateRight(uint32_t x)
+    {
+        uint32_t y = at(x).left;
+        at(x).left = at(y).right;
+        at(y).right = x;
+        metrics.total_rotations++;
+        return y;
+    }
+
+    uint32_t rotateLeft(uint32_t x)
+    {
+        uint32_t y = at(x).right;
+        at(x).right = at(y).left;
+        at(y).left = x;
+        metrics.total_rotations++;
+        return y;
+    }
+
+    // Top-down splay of key within the auxiliary tree rooted at node, as in
+    // SplayTree::splay. Roots of other auxiliary trees count as empty links and
+    // move along with the node they hang from; the result takes over node's mark.
+    uint32_t splay(uint32_t node, int key)
+    {
+        bool top = at(node).isRoot;
+        at(node).isRoot = false;
+
+        uint32_t leftRoot = NIL, leftMax = NIL;
+        uint32_t rightRoot = NIL, rightMin = NIL;
+
+        auto linkLeft = [&](uint32_t n)
+        {
+            if (leftMax == NIL)
+                leftRoot = n;
+            else
+                at(leftMax).right = n;
+            leftMax = n;
+            metrics.total_rotations++;
+        };
+        auto linkRight = [&](uint32_t n)
+        {
+            if (rightMin == NIL)
+                rightRoot = n;
+            else
+                at(rightMin).left = n;
+            rightMin = n;
+            metrics.total_rotations++;
+        };
+
+        while (at(node).key != key)
+        {
+            metrics.total_comparisons++;
+
+            if (key < at(node).key)
+            {
+                uint32_t l = at(node).left;
+                if (isLeaf(l))
+                    break;
+
+                metrics.total_comparisons++;
+                if (key < at(l).key)
+                {
+                    node = rotateRight(node);
+                    if (isLeaf(at(node).left))
+                        break;
+                    linkRight(node);
+                    node = at(node).left;
+                }
+                else if (key > at(l).key && !isLeaf(at(l).right))
+                {
+                    linkRight(node);
+                    linkLeft(l);
+                    node = at(l).right;
+                }
+                else
+                {
+                    linkRight(node);
+                    node = l;
+                    break;
+                }
+            }
+            else
+            {
+                uint32_t r = at(node).right;
+                if (isLeaf(r))
+                    break;
+
+                metrics.total_comparisons++;
+                if (key > at(r).key)
+                {
+                    node = rotateLeft(node);
+                    if (isLeaf(at(node).right))
+                        break;
+                    linkLeft(node);
+                    node = at(node).right;
+                }
+                else if (key < at(r).key && !isLeaf(at(r).left))
+                {
+                    linkLeft(node);
+                    linkRight(r);
+                    node = at(r).left;
+                }
+                else
+                {
+                    linkLeft(node);
+                    node = r;
+                    break;
+                }
+            }
+        }
+
+        if (leftMax != NIL)
+        {
+            at(leftMax).right = at(node).left;
+            at(node).left = leftRoot;
+        }
+        if (rightMin != NIL)
+        {
+            at(rightMin).left = at(node).right;
+            at(node).right = rightRoot;
+        }
+        at(node).isRoot = top;
+        return node;
+    }
+
+    // Makes side (PREF_LEFT, PREF_RIGHT or PREF_NONE) the preferred child of u,
+    // which lies in the top auxiliary tree, and leaves u at the root. The path
+    // nodes in u's subtrees are its ancestors, shallower than u, or its preferred
+    // descendants, deeper than u and next to u in key order; that is what the
+    // searches for l and r rely on.
+    void switchPreferred(uint32_t u, uint8_t side)
+    {
+        root = splay(root, at(u).key);
+        int d = at(u).depth;
+
+        uint32_t l = NIL, r = NIL;
+        for (uint32_t n = at(u).left; !isLeaf(n); n = (at(n).depth < d) ? at(n).right : at(n).left)
+        {
+            if (at(n).depth < d)
+                l = n;
+        }
+        for (uint32_t n = at(u).right; !isLeaf(n); n = (at(n).depth < d) ? at(n).left : at(n).right)
+        {
+            if (at(n).depth < d)
+                r = n;
+        }
+
+        uint32_t leftSide = at(u).left;
+        if (l != NIL)
+        {
+            at(u).left = splay(at(u).left, at(l).key);
+            leftSide = at(at(u).left).right;
+        }
+        uint32_t rightSide = at(u).right;
+        if (r != NIL)
+        {
+            at(u).right = splay(at(u).right, at(r).key);
+            rightSide = at(at(u).right).left;
+        }
+        if (leftSide != NIL)
+            at(leftSide).isRoot = (side != PREF_LEFT);
+        if (rightSide != NIL)
+            at(rightSide).isRoot = (side != PREF_RIGHT);
+    }
+
+    // Initially every reference node is its own preferred path, so the tree starts
+    // out with the shape of the reference tree.
+    void build()
+    {
+        dirty = false;
+        deadCount = 0;
+        pool.clear();
+        root = NIL;
+        if (refTree.root == NIL)
+            return;
+
+        struct Frame
+        {
+            uint32_t ref;
+            uint32_t *slot;
+            int depth;
+        };
+        vector<Frame> stack = {{refTree.root, &root, 0}};
+        while (!stack.empty())
+        {
+            Frame f = stack.back();
+            stack.pop_back();
+            const ReferenceNode &r = refTree.at(f.ref);
+            uint32_t n = pool.alloc(r.key, f.depth);
+            *f.slot = n;
+            if (r.left != NIL)
+                stack.push_back({r.left, &at(n).left, f.depth + 1});
+            if (r.right != NIL)
+                stack.push_back({r.right, &at(n).right, f.depth + 1});
+        }
+    }
+
+    // Ordinary BST descent over the whole tree, crossing auxiliary tree
+    // boundaries. Returns the node holding key, or the link where it would hang.
+    uint32_t *locate(int key)
+    {
+        uint32_t *slot = &root;
+        while (*slot != NIL && at(*slot).key != key)
+        {
+            metrics.total_comparisons++;
+            slot = (key < at(*slot).key) ? &at(*slot).left : &at(*slot).right;
+        }
+        return slot;
+    }
+
+    // Physically removes the tombstoned keys from the reference tree; the tree is
+    // rebuilt on the next access.
+    void purge()
+    {
+        vector<uint32_t> stack = {root};
+        while (!stack.empty())
+        {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            if (n == NIL)
+                continue;
+            if (at(n).deleted)
+                refTree.remove(at(n).key);
+            stack.push_back(at(n).left);
+            stack.push_back(at(n).right);
+        }
+        dirty = true;
+    }
+
+    uint32_t deeper(uint32_t a, uint32_t b)
+    {
+        if (a == NIL)
+            return b;
+        return (b != NIL && at(b).depth > at(a).depth) ? b : a;
+    }
+
+    // Runs the multi-splay access for key and returns the last node reached, which
+    // ends up at the root.
+    uint32_t access(int key)
+    {
+        if (dirty)
+            build();
+        if (root == NIL)
+            return NIL;
+
+        // pred and succ are the last nodes of the top auxiliary tree passed on either
+        // side of key: the neighbours of the gap an auxiliary tree hangs in. The
+        // deeper of them is the reference parent of that tree's top node.
+        uint32_t v = root, pred = NIL, succ = NIL;
+        while (true)
+        {
+            metrics.total_comparisons++;
+            if (key == at(v).key)
+                break;
+            uint32_t c;
+            if (key < at(v).key)
+            {
+                succ = v;
+                c = at(v).left;
+            }
+            else
+            {
+                pred = v;
+                c = at(v).right;
+            }
+            if (c == NIL)
+            {
+                // A miss ends at the deeper neighbour of key, which need not be the
+                // last node compared in the splayed shape.
+                v = deeper(pred, succ);
+                break;
+            }
+            if (at(c).isRoot)
+            {
+                metrics.total_path_switches++;
+                uint32_t u = deeper(pred, succ);
+                switchPreferred(u, (key < at(u).key) ? PREF_LEFT : PREF_RIGHT);
+                v = root;
+                pred = succ = NIL;
+                continue;
+            }
+            v = c;
+        }
+
+        // The accessed node has no preferred child afterwards.
+        switchPreferred(v, PREF_NONE);
+        return v;
+    }
+
+public:
+    void prepare() override
+    {
+        if (dirty)
+            build();
+    }
+
+    // Before the first access, keys only go into the reference tree. Afterwards a
+    // new key becomes a leaf of the reference tree and therefore a one-node
+    // preferred path, hung at its BST position.
+    void insert(int key) override
+    {
+        uint32_t ref = refTree.insert(key);
+        if (dirty || root == NIL)
+        {
+            dirty = true;
+            return;
+        }
+
+        uint32_t *slot = locate(key);
+        if (*slot != NIL)
+        {
+            if (at(*slot).deleted)
+            {
+                at(*slot).deleted = false;
+                deadCount--;
+            }
+            return;
+        }
+        *slot = pool.alloc(key, refTree.depth(ref));
+    }
+
+    bool search(int key) override
+    {
+        uint32_t v = access(key);
+        return v != NIL && at(v).key == key && !at(v).deleted;
+    }
+
+    // Removal accesses the key like a search and leaves a tombstone; the reference
+    // tree is rebuilt without them once they outnumber the live keys.
+    void remove(int key) override
+    {
+        if (dirty)
+        {
+            refTree.remove(key);
+            return;
+        }
+        uint32_t v = access(key);
+        if (v == NIL || at(v).key != key || at(v).deleted)
+            return;
+        at(v).deleted = true;
+        if (++deadCount * 2 > refTree.size)
+            purge();
+    }
+
+    void nodeDepths(vector<uint64_t> &count) override
+    {
+        if (dirty)
+            build();
+        countDepths(root, NIL, [&](uint32_t n)
+        {
+            return at(n).left;
+        }, [&](uint32_t n)
+        {
+            return at(n).right;
+        }, count);
+    }
+
+    double bytesPerNode() const override
+    {
+        return pool.bytesPerNode() + refTree.nodes.bytesPerNode();
+    }
+};
+
+// Skip list with level links and a finger (Pugh's finger search). Every level of
+// a key's tower is its own pool node, linked to its neighbours on that level both
+// ways and to the levels above and below it. A search starts from the key of the
+// previous access: it climbs the towers towards key until the next node on the
+// current level lies beyond it, then descends as in an ordinary skip list. Towers
+// are about 4^i nodes apart on level i, so a search that lands d keys away from
+// the finger climbs O(log d) levels and takes O(log d) expected comparisons, which
+// is the dynamic finger behaviour that sequential and zigzag traces reward. The
+// head and tail towers span all levels and stand for -inf and +inf.
+template <typename Metrics = BSTMetrics>
+class FingerSkipList final : public BST<Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    static constexpr uint32_t MAX_LEVEL = 16;
+
+    struct Node
+    {
+        int key;
+        uint32_t prev;
+        uint32_t next;
+        uint32_t up;
+        uint32_t down;
+
+        Node(int k = 0) : key(k), prev(NIL), next(NIL), up(NIL), down(NIL) {}
+    };
+
+    NodePool<Node> pool;
+    uint32_t head = 0, tail = 1; // bottom level sentinels
+    uint32_t finger = 0;         // bottom node of the last key accessed, or head
+    size_t count = 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+    Node &at(uint32_t i) { return pool[i]; }
+
+    // The sentinels are the first nodes allocated, a head and a tail per level, and
+    // are never released.
+    static bool isSentinel(uint32_t n) { return n < 2 * MAX_LEVEL; }
+    static bool isHead(uint32_t n) { return n % 2 == 0; }
+
+    // Whether n lies strictly before key, or at or after it; the sentinels compare
+    // without a key comparison.
+    bool before(uint32_t n, int key)
+    {
+        if (isSentinel(n))
+            return isHead(n);
+        metrics.total_comparisons++;
+        return at(n).key < key;
+    }
+
+    bool atOrAfter(uint32_t n, int key)
+    {
+        if (isSentinel(n))
+            return !isHead(n);
+        metrics.total_comparisons++;
+        return at(n).key >= key;
+    }
+
+    // Height of a new tower: each further level with probability 1/4.
+    uint32_t randomHeight()
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return min(1u + __builtin_ctzll(rng | (1ull << 62)) / 2, MAX_LEVEL);
+    }
+
+    // Returns the bottom node of the first key >= key, or tail, searching from the
+    // finger.
+    uint32_t seek(int key)
+    {
+        uint32_t x = finger;
+        if (before(x, key))
+        {
+            while (before(at(x).next, key))
+                x = (at(x).up != NIL) ? at(x).up : at(x).next;
+            while (true)
+            {
+                while (before(at(x).next, key))
+                    x = at(x).next;
+                if (at(x).down == NIL)
+                    return at(x).next;
+                x = at(x).down;
+            }
+        }
+
+        while (atOrAfter(at(x).prev, key))
+            x = (at(x).up != NIL) ? at(x).up : at(x).prev;
+        while (true)
+        {
+            while (atOrAfter(at(x).prev, key))
+                x = at(x).prev;
+            if (at(x).down == NIL)
+                return x;
+            x = at(x).down;
+        }
+    }
+
+    // Links n into its level right after p.
+    void linkAfter(uint32_t p, uint32_t n)
+    {
+        uint32_t q = at(p).next;
+        at(n).prev = p;
+        at(n).next = q;
+        at(p).next = n;
+        at(q).prev = n;
+    }
+
+    bool matches(uint32_t n, int key)
+    {
+        if (n == tail)
+            return false;
+        metrics.total_comparisons++;
+        return at(n).key == key;
+    }
+
+public:
+    FingerSkipList()
+    {
+        for (uint32_t level = 0; level < MAX_LEVEL; level++)
+        {
+            uint32_t h = pool.alloc(), t = pool.alloc();
+            at(h).next = t;
+            at(t).prev = h;
+            if (level > 0)
+            {
+                at(h).down = h - 2;
+                at(t).down = t - 2;
+                at(h - 2).up = h;
+                at(t - 2).up = t;
+            }
+        }
+    }
+
+    // The predecessor on each higher level is found by walking left from the one
+    // below to the nearest taller tower, O(1) steps in expectation.
+    void insert(int key) override
+    {
+        uint32_t s = seek(key);
+        if (matches(s, key))
+        {
+            finger = s;
+            return;
+        }
+
+        uint32_t p = at(s).prev, below = NIL;
+        uint32_t height = randomHeight();
+        for (uint32_t level = 0; level < height; level++)
+        {
+            if (level > 0)
+            {
+                while (at(p).up == NIL)
+                    p = at(p).prev;
+                p = at(p).up;
+            }
+            uint32_t n = pool.alloc(key);
+            linkAfter(p, n);
+            at(n).down = below;
+            if (below != NIL)
+                at(below).up = n;
+            else
+                finger = n;
+            below = n;
+        }
+        count++;
+    }
+
+    // A miss leaves the finger at the nearest smaller key.
+    bool search(int key) override
+    {
+        uint32_t s = seek(key);
+        bool found = matches(s, key);
+        finger = found ? s : at(s).prev;
+        return found;
+    }
+
+    void remove(int key) override
+    {
+        uint32_t s = seek(key);
+        if (!matches(s, key))
+        {
+            finger = at(s).prev;
+            return;
+        }
+
+        finger = at(s).prev;
+        while (s != NIL)
+        {
+            uint32_t up = at(s).up;
+            at(at(s).prev).next = at(s).next;
+            at(at(s).next).prev = at(s).prev;
+            pool.release(s);
+            s = up;
+        }
+        count--;
+    }
+
+    // The ordered queries search from the finger too, and leave it at the last key
+    // they report.
+    bool successor(int key, int *out) override
+    {
+        uint32_t s = seek(key);
+        if (matches(s, key))
+            s = at(s).next;
+        if (s == tail)
+            return false;
+        finger = s;
+        *out = at(s).key;
+        return true;
+    }
+
+    bool predecessor(int key, int *out) override
+    {
+        uint32_t p = at(seek(key)).prev;
+        if (p == head)
+            return false;
+        finger = p;
+        *out = at(p).key;
+        return true;
+    }
+
+    size_t rangeScan(int lo, int hi, const function<void(int)> &visit) override
+    {
+        size_t count = 0;
+        for (uint32_t n = seek(lo); n != tail; n = at(n).next)
+        {
+            metrics.total_comparisons++;
+            if (at(n).key > hi)
+                break;
+            visit(at(n).key);
+            finger = n;
+            count++;
+        }
+        return count;
+    }
+
+    // Pool bytes per key, counting every level of the towers and the sentinels.
+    double bytesPerNode() const override
+    {
+        return count ? pool.bytesPerNode() * pool.size() / count : 0.0;
+    }
+};
+
+// Base for static search layouts. Inserted keys are collected and frozen into the
+// layout on the next search; a remove unfreezes it again. Meant for the read-only
+// phase after insert_sequence is loaded, not for churn. The layout supplies
+// freeze(), lookup() and lookupBatch(), called without virtual dispatch.
+template <typename Derived, typename Metrics>
+class FrozenBST : public BST<Metrics>
+{
+private:
+    vector<int> keys;
+    bool dirty = false;
+
+    void refreeze()
+    {
+        if (!dirty)
+            return;
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        static_cast<Derived *>(this)->freeze(keys);
+        dirty = false;
+    }
+
+    static void fillBFS(const vector<int> &sorted, vector<int> &slots, size_t &i, size_t k)
+    {
+        if (k >= slots.size())
+            return;
+        fillBFS(sorted, slots, i, 2 * k);
+        slots[k] = sorted[i++];
+        fillBFS(sorted, slots, i, 2 * k + 1);
+    }
+
+protected:
+    // Lays sorted out as a complete BST in slots[1..n], where slot k has the
+    // children 2k and 2k+1.
+    static void fillBFS(const vector<int> &sorted, vector<int> &slots)
+    {
+        slots.assign(sorted.size() + 1, 0);
+        size_t i = 0;
+        fillBFS(sorted, slots, i, 1);
+    }
+
+public:
+    void prepare() override { refreeze(); }
+
+    void insert(int key) override
+    {
+        keys.push_back(key);
+        dirty = true;
+    }
+
+    bool search(int key) override
+    {
+        refreeze();
+        return static_cast<Derived *>(this)->lookup(key);
+    }
+
+    void searchBatch(KeySpan batch, bool *out) override
+    {
+        refreeze();
+        static_cast<Derived *>(this)->lookupBatch(batch, out);
+    }
+
+    void remove(int key) override
+    {
+        auto it = std::remove(keys.begin(), keys.end(), key);
+        if (it == keys.end())
+            return;
+        keys.erase(it, keys.end());
+        dirty = true;
+    }
+};
+
+// Complete BST stored in BFS order (Eytzinger layout): the children of slot k are
+// 2k and 2k+1, so the top levels share cache lines. Each step prefetches the line
+// holding the 16 descendants four levels down.
+template <typename Metrics = BSTMetrics>
+class EytzingerTree final : public FrozenBST<EytzingerTree<Metrics>, Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    using Base = FrozenBST<EytzingerTree, Metrics>;
+    friend Base;
+
+    vector<int> slots; // 1-based, slots[0] unused
+
+protected:
+    void freeze(const vector<int> &sorted)
+    {
+        Base::fillBFS(sorted, slots);
+    }
+
+    bool lookup(int key)
+    {
+        const int *b = slots.data();
+        size_t n = slots.size() - 1;
+        size_t k = 1;
+        while (k <= n)
+        {
+            __builtin_prefetch(b + 16 * k);
+            metrics.total_comparisons++;
+            if (b[k] == key)
+                return true;
+            k = 2 * k + (b[k] < key);
+        }
+        return false;
+    }
+
+    // Each step prefetches the line holding the four grandchildren of the slot the
+    // lookup moves to. With the group's other lookups interleaved, two levels of
+    // lookahead cover the latency; four, as in lookup(), waste bandwidth on lines
+    // the lookup never reaches.
+    void lookupBatch(KeySpan batch, bool *out)
+    {
+        const int *b = slots.data();
+        size_t n = slots.size() - 1;
+        interleaveLookups<size_t>(batch, out, [](int)
+        {
+            return size_t(1);
+        }, [&](int key, size_t &k)
+        {
+            if (k > n)
+                return STEP_MISSING;
+            metrics.total_comparisons++;
+            if (b[k] == key)
+                return STEP_FOUND;
+            k = 2 * k + (b[k] < key);
+            if (k > n)
+                return STEP_MISSING;
+            __builtin_prefetch(b + 4 * k);
+            return STEP_MORE;
+        });
+    }
+
+public:
+    EytzingerTree() : slots(1) {}
+
+    double bytesPerNode() const override
+    {
+        return (slots.size() > 1) ? static_cast<double>(slots.capacity() * sizeof(int)) / (slots.size() - 1) : 0.0;
+    }
+};
+
+// The same complete BST laid out in van Emde Boas order: the top half of the levels
+// is stored first, followed by each bottom subtree, recursively. Any root-to-leaf
+// path then touches O(log_B n) blocks for every block size B. Children are linked
+// by 32-bit index as in the pooled trees.
+template <typename Metrics = BSTMetrics>
+class VanEmdeBoasTree final : public FrozenBST<VanEmdeBoasTree<Metrics>, Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    using Base = FrozenBST<VanEmdeBoasTree, Metrics>;
+    friend Base;
+
+    struct Node
+    {
+        int key;
+        uint32_t left;
+        uint32_t right;
+    };
+
+    vector<Node> nodes;
+
+    // Numbers the BFS slots of the subtree rooted at k with the given height in vEB order.
+    static void layout(size_t k, int height, size_t n, vector<uint32_t> &position, uint32_t &next)
+    {
+        if (k > n)
+            return;
+        if (height == 1)
+        {
+            position[k] = next++;
+            return;
+        }
+        int top = height / 2;
+        int bottom = height - top;
+        layout(k, top, n, position, next);
+        size_t first = k << top;
+        for (size_t j = 0; j < (size_t(1) << top); j++)
+            layout(first + j, bottom, n, position, next);
+    }
+
+protected:
+    void freeze(const vector<int> &sorted)
+    {
+        size_t n = sorted.size();
+        vector<int> slots;
+        Base::fillBFS(sorted, slots);
+
+        int height = 0;
+        while ((size_t(1) << height) <= n)
+            height++;
+        vector<uint32_t> position(n + 1, NIL); // BFS slot -> index in nodes
+        uint32_t next = 0;
+        layout(1, height, n, position, next);
+
+        nodes.assign(n, Node());
+        for (size_t k = 1; k <= n; k++)
+        {
+            Node &node = nodes[position[k]];
+            node.key = slots[k];
+            node.left = (2 * k <= n) ? position[2 * k] : NIL;
+            node.right = (2 * k + 1 <= n) ? position[2 * k + 1] : NIL;
+        }
+    }
+
+    bool lookup(int key)
+    {
+        uint32_t curr = nodes.empty() ? NIL : 0;
+        while (curr != NIL)
+        {
+            metrics.total_comparisons++;
+            const Node &node = nodes[curr];
+            if (node.key == key)
+                return true;
+            curr = (key < node.key) ? node.left : node.right;
+        }
+        return false;
+    }
+
+    void lookupBatch(KeySpan batch, bool *out)
+    {
+        uint32_t root = nodes.empty() ? NIL : 0;
+        interleaveLookups<uint32_t>(batch, out, [&](int)
+        {
+            return root;
+        }, [&](int key, uint32_t &curr)
+        {
+            if (curr == NIL)
+                return STEP_MISSING;
+            metrics.total_comparisons++;
+            const Node &node = nodes[curr];
+            if (node.key == key)
+                return STEP_FOUND;
+            curr = (key < node.key) ? node.left : node.right;
+            if (curr == NIL)
+                return STEP_MISSING;
+            __builtin_prefetch(&nodes[curr]);
+            return STEP_MORE;
+        });
+    }
+
+public:
+    double bytesPerNode() const override
+    {
+        return nodes.empty() ? 0.0 : static_cast<double>(nodes.capacity() * sizeof(Node)) / nodes.size();
+    }
+};
+
+// B+tree with 16-key nodes. Keys live in the leaves; inner nodes hold the smallest
+// key of each child but the first. Unused key slots are padded with INT_MAX so that
+// a node is searched with whole-vector compares and a popcount, without a loop over
+// its keys. Each visited node counts its keys as comparisons. Removal does not
+// rebalance: leaves may underflow or empty out, and separators stay valid bounds.
+template <typename Metrics = BSTMetrics>
+class BPlusTree final : public BST<Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    static constexpr int B = 16;
+
+    struct Leaf
+    {
+        alignas(64) int keys[B];
+        int count;
+        uint32_t next; // right sibling, NIL for the last leaf
+
+        Leaf() : count(0), next(NIL) { fill(keys, keys + B, INT_MAX); }
+    };
+
+    struct Inner
+    {
+        alignas(64) int keys[B];
+        uint32_t children[B + 1];
+        int count; // number of keys; count + 1 children
+
+        Inner() : count(0) { fill(keys, keys + B, INT_MAX); }
+    };
+
+    struct Split
+    {
+        int separator;
+        uint32_t right; // NIL if the child did not split
+    };
+
+    NodePool<Leaf> leaves;
+    NodePool<Inner> inners;
+    uint32_t root;
+    int height = 0; // inner levels above the leaves
+    size_t size = 0;
+
+    // Number of keys in the node that are less than key.
+    static int countLess(const int *keys, int key)
+    {
+#if defined(__AVX2__)
+        __m256i k = _mm256_set1_epi32(key);
+        __m256i lo = _mm256_cmpgt_epi32(k, _mm256_load_si256(reinterpret_cast<const __m256i *>(keys)));
+        __m256i hi = _mm256_cmpgt_epi32(k, _mm256_load_si256(reinterpret_cast<const __m256i *>(keys + 8)));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(lo))) |
+                        static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(hi))) << 8;
+        return __builtin_popcount(mask);
+#elif defined(__SSE2__)
+        __m128i k = _mm_set1_epi32(key);
+        int n = 0;
+        for (int i = 0; i < B; i += 4)
+        {
+            __m128i c = _mm_cmpgt_epi32(k, _mm_load_si128(reinterpret_cast<const __m128i *>(keys + i)));
+            n += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(c)));
+        }
+        return n;
+#else
+        int n = 0;
+        for (int i = 0; i < B; i++)
+            n += keys[i] < key;
+        return n;
+#endif
+    }
+
+    // Child of an inner node that covers key: the number of separators <= key.
+    uint32_t childFor(const Inner &node, int key)
+    {
+        metrics.total_node_visits++;
+        metrics.total_comparisons += node.count;
+        int i = (key == INT_MAX) ? node.count : countLess(node.keys, key + 1);
+        return node.children[min(i, node.count)];
+    }
+
+    Split insertInto(uint32_t node, int level, int key)
+    {
+        if (level == 0)
+        {
+            Leaf &leaf = leaves[node];
+            metrics.total_node_visits++;
+            metrics.total_comparisons += leaf.count;
+            int i = min(countLess(leaf.keys, key), leaf.count);
+            if (i < leaf.count && leaf.keys[i] == key)
+                return {0, NIL};
+            size++;
+            if (leaf.count < B)
+            {
+                copy_backward(leaf.keys + i, leaf.keys + leaf.count, leaf.keys + leaf.count + 1);
+                leaf.keys[i] = key;
+                leaf.count++;
+                return {0, NIL};
+            }
+
+            // Split a full leaf into two halves of B/2 (+1) keys.
+            int merged[B + 1];
+            copy(leaf.keys, leaf.keys + i, merged);
+            merged[i] = key;
+            copy(leaf.keys + i, leaf.keys + B, merged + i + 1);
+            uint32_t rightIdx = leaves.alloc();
+            Leaf &l = leaves[node];
+            Leaf &r = leaves[rightIdx];
+            int half = (B + 1) / 2;
+            fill(l.keys, l.keys + B, INT_MAX);
+            copy(merged, merged + half, l.keys);
+            l.count = half;
+            copy(merged + half, merged + B + 1, r.keys);
+            r.count = B + 1 - half;
+            r.next = l.next;
+            l.next = rightIdx;
+            return {r.keys[0], rightIdx};
+        }
+
+        uint32_t child = childFor(inners[node], key);
+        Split s = insertInto(child, level - 1, key);
+        if (s.right == NIL)
+            return s;
+
+        Inner &in = inners[node];
+        int i = min(countLess(in.keys, s.separator), in.count);
+        if (in.count < B)
+        {
+            copy_backward(in.keys + i, in.keys + in.count, in.keys + in.count + 1);
+            copy_backward(in.children + i + 1, in.children + in.count + 1, in.children + in.count + 2);
+            in.keys[i] = s.separator;
+            in.children[i + 1] = s.right;
+            in.count++;
+            return {0, NIL};
+        }
+
+        // Split a full inner node; the middle separator moves up.
+        int keys[B + 1];
+        uint32_t children[B + 2];
+        copy(in.keys, in.keys + i, keys);
+        keys[i] = s.separator;
+        copy(in.keys + i, in.keys + B, keys + i + 1);
+        copy(in.children, in.children + i + 1, children);
+        children[i + 1] = s.right;
+        copy(in.children + i + 1, in.children + B + 1, children + i + 2);
+
+        uint32_t rightIdx = inners.alloc();
+        Inner &l = inners[node];
+        Inner &r = inners[rightIdx];
+        int half = B / 2;
+        fill(l.keys, l.keys + B, INT_MAX);
+        copy(keys, keys + half, l.keys);
+        copy(children, children + half + 1, l.children);
+        l.count = half;
+        copy(keys + half + 1, keys + B + 1, r.keys);
+        copy(children + half + 1, children + B + 2, r.children);
+        r.count = B - half;
+        return {keys[half], rightIdx};
+    }
+
+    uint32_t findLeaf(int key)
+    {
+        uint32_t node = root;
+        for (int level = height; level > 0; level--)
+            node = childFor(inners[node], key);
+        return node;
+    }
+
+public:
+    BPlusTree() : root(leaves.alloc()) {}
+
+    void insert(int key) override
+    {
+        Split s = insertInto(root, height, key);
+        if (s.right == NIL)
+            return;
+        uint32_t newRoot = inners.alloc();
+        Inner &in = inners[newRoot];
+        in.keys[0] = s.separator;
+        in.children[0] = root;
+        in.children[1] = s.right;
+        in.count = 1;
+        root = newRoot;
+        height++;
+    }
+
+    bool search(int key) override
+    {
+        const Leaf &leaf = leaves[findLeaf(key)];
+        metrics.total_node_visits++;
+        metrics.total_comparisons += leaf.count;
+        int i = countLess(leaf.keys, key);
+        return i < leaf.count && leaf.keys[i] == key;
+    }
+
+    void remove(int key) override
+    {
+        Leaf &leaf = leaves[findLeaf(key)];
+        metrics.total_node_visits++;
+        metrics.total_comparisons += leaf.count;
+        int i = countLess(leaf.keys, key);
+        if (i >= leaf.count || leaf.keys[i] != key)
+            return;
+        copy(leaf.keys + i + 1, leaf.keys + leaf.count, leaf.keys + i);
+        leaf.keys[--leaf.count] = INT_MAX;
+        size--;
+    }
+
+    // Bytes of both node pools per stored key.
+    double bytesPerNode() const override
+    {
+        double bytes = leaves.bytesPerNode() * leaves.size() + inners.bytesPerNode() * inners.size();
+        return size ? bytes / size : 0.0;
+    }
+};
+
+// Conflicts met by the accesses of one thread to an OptimisticSplayTree.
+struct Contention
+{
+    int64_t rotations = 0; // rotations carried out
+    int64_t conflicts = 0; // rotations given up because a node was locked or had changed
+    int64_t retries = 0;   // descents restarted because a node changed under them
+};
+
+// Partial-splay BST that many threads can access at once. Every node carries a
+// version that is even while the node is stable and odd while a writer holds it.
+// A descent reads each node's version before following its link and checks that
+// the parent is still at the version it read, so it never holds a lock and starts
+// over only when a node on its path changed meanwhile. Writers lock a node by
+// moving its version from the one they validated to the next odd number, which
+// fails if anything changed since.
+//
+// A search that finds its key at more than twice the height of a perfectly
+// balanced tree of the same size rotates the node one level up, if it can lock the node, its
+// parent and its grandparent at once; otherwise it counts a conflict and leaves the
+// tree as it is. Removal only clears the node's present flag, so nodes are never
+// unlinked or reused, and a descent may read any node without reclamation hazards.
+// All operations may run concurrently; the metrics counters are not atomic, though,
+// so concurrent runs use NoMetrics.
+template <typename Metrics = BSTMetrics>
+class OptimisticSplayTree final : public BST<Metrics>
+{
+public:
+    using BST<Metrics>::metrics;
+
+private:
+    struct Node
+    {
+        int key = 0;
+        atomic<bool> present{false};
+        atomic<uint32_t> left{NIL};
+        atomic<uint32_t> right{NIL};
+        atomic<uint32_t> version{0};
+    };
+
+    enum Access
+    {
+        ACCESS_SEARCH,
+        ACCESS_INSERT,
+        ACCESS_REMOVE
+    };
+
+    // Nodes live in slabs as in NodePool, but the slab table has a fixed size, so
+    // that readers can index it while another thread adds a slab.
+    static constexpr uint32_t SLAB_BITS = 14;
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+    static constexpr uint32_t SLAB_MASK = SLAB_SIZE - 1;
+    static constexpr size_t MAX_SLABS = size_t(1) << (32 - SLAB_BITS);
+
+    unique_ptr<atomic<Node *>[]> slabs;
+    mutex allocLock;
+    uint32_t next = 0;
+    atomic<uint32_t> count{0};
+    Node holder; // its left link is the root
+
+    Node &at(uint32_t i) { return slabs[i >> SLAB_BITS].load(memory_order_acquire)[i & SLAB_MASK]; }
+
+    uint32_t alloc(int key)
+    {
+        lock_guard<mutex> guard(allocLock);
+        if ((next & SLAB_MASK) == 0)
+            slabs[next >> SLAB_BITS].store(new Node[SLAB_SIZE], memory_order_release);
+        uint32_t i = next++;
+        Node &node = at(i);
+        node.key = key;
+        node.present.store(true, memory_order_relaxed);
+        count.fetch_add(1, memory_order_relaxed);
+        return i;
+    }
+
+    static uint32_t stableVersion(const Node &node)
+    {
+        uint32_t v;
+        while ((v = node.version.load(memory_order_acquire)) & 1)
+            this_thread::yield();
+        return v;
+    }
+
+    // True if node is still at version v, i.e. what was read from it since is valid.
+    static bool validate(const Node &node, uint32_t v)
+    {
+        atomic_thread_fence(memory_order_acquire);
+        return node.version.load(memory_order_relaxed) == v;
+    }
+
+    static bool tryLock(Node &node, uint32_t v)
+    {
+        if (!node.version.compare_exchange_strong(v, v + 1, memory_order_acquire))
+            return false;
+        atomic_thread_fence(memory_order_release);
+        return true;
+    }
+
+    static void unlock(Node &node) { node.version.fetch_add(1, memory_order_release); }
+
+    atomic<uint32_t> &childLink(Node &node, int key)
+    {
+        return (&node == &holder || key < node.key) ? node.left : node.right;
+    }
+
+    // Height of a perfectly balanced tree with as many nodes.
+    uint32_t balancedDepth() const
+    {
+        uint32_t n = count.load(memory_order_relaxed);
+        return n ? 32 - __builtin_clz(n) : 0;
+    }
+
+    // A node on the path of a descent, with the version it was validated at.
+    struct Step
+    {
+        Node *node;
+        uint32_t index;
+        uint32_t version;
+    };
+
+    // Rotates x above its parent p, whose parent is g, if all three are still at
+    // the versions the descent saw. Locks are taken top-down and never waited for.
+    void rotateUp(const Step &g, const Step &p, const Step &x, Contention &c)
+    {
+        if (!tryLock(*g.node, g.version))
+        {
+            c.conflicts++;
+            return;
+        }
+        if (!tryLock(*p.node, p.version))
+        {
+            unlock(*g.node);
+            c.conflicts++;
+            return;
+        }
+        if (!tryLock(*x.node, x.version))
+        {
+            unlock(*p.node);
+            unlock(*g.node);
+            c.conflicts++;
+            return;
+        }
+
+        Node &gn = *g.node, &pn = *p.node, &xn = *x.node;
+        if (pn.left.load(memory_order_relaxed) == x.index)
+        {
+            pn.left.store(xn.right.load(memory_order_relaxed), memory_order_release);
+            xn.right.store(p.index, memory_order_release);
+        }
+        else
+        {
+            pn.right.store(xn.left.load(memory_order_relaxed), memory_order_release);
+            xn.left.store(p.index, memory_order_release);
+        }
+        (gn.left.load(memory_order_relaxed) == p.index ? gn.left : gn.right).store(x.index, memory_order_release);
+        metrics.total_rotations++;
+        c.rotations++;
+
+        unlock(xn);
+        unlock(pn);
+        unlock(gn);
+    }
+
+    // One optimistic descent. Returns false if a node on the path changed and the
+    // access has to start over; otherwise found tells whether key was present.
+    bool tryAccess(int key, Access access, Contention &c, bool &found)
+    {
+        Step grand = {nullptr, NIL, 0};
+        Step parent = {&holder, NIL, stableVersion(holder)};
+        uint32_t link = holder.left.load(memory_order_acquire);
+        uint32_t depth = 0;
+
+        while (link != NIL)
+        {
+            Step curr = {&at(link), link, 0};
+            curr.version = stableVersion(*curr.node);
+            if (!validate(*parent.node, parent.version))
+                return false;
+            metrics.total_comparisons++;
+            depth++;
+
+            if (curr.node->key == key)
+            {
+                if (access == ACCESS_SEARCH)
+                {
+                    found = curr.node->present.load(memory_order_acquire);
+                    if (grand.node && depth > 2 * balancedDepth())
+                        rotateUp(grand, parent, curr, c);
+                }
+                else
+                {
+                    found = curr.node->present.exchange(access == ACCESS_INSERT, memory_order_acq_rel);
+                }
+                return true;
+            }
+
+            grand = parent;
+            parent = curr;
+            link = childLink(*curr.node, key).load(memory_order_acquire);
+        }
+
+        found = false;
+        if (access != ACCESS_INSERT)
+            return validate(*parent.node, parent.version);
+
+        // Lock the leaf's parent at the version whose empty link was read, which
+        // also keeps a second insert of the same key from taking the same place.
+        if (!tryLock(*parent.node, parent.version))
+            return false;
+        childLink(*parent.node, key).store(alloc(key), memory_order_release);
+        unlock(*parent.node);
+        return true;
+    }
+
+    bool access(int key, Access type, Contention &c)
+    {
+        bool found = false;
+        while (!tryAccess(key, type, c, found))
+            c.retries++;
+        return found;
+    }
+
+public:
+    OptimisticSplayTree() : slabs(make_unique<atomic<Node *>[]>(MAX_SLABS)) {}
+
+    ~OptimisticSplayTree()
+    {
+        for (size_t s = 0; s < MAX_SLABS && slabs[s].load(); s++)
+            delete[] slabs[s].load();
+    }
+
+    void insert(int key) override
+    {
+        Contention c;
+        access(key, ACCESS_INSERT, c);
+    }
+
+    bool search(int key) override
+    {
+        Contention c;
+        return access(key, ACCESS_SEARCH, c);
+    }
+
+    void remove(int key) override
+    {
+        Contention c;
+        access(key, ACCESS_REMOVE, c);
+    }
+
+    // Search that reports its conflicts into c, one per thread.
+    bool search(int key, Contention &c) { return access(key, ACCESS_SEARCH, c); }
+
+    double bytesPerNode() const override
+    {
+        size_t used = (next + SLAB_MASK) >> SLAB_BITS;
+        return next ? static_cast<double>(used * SLAB_SIZE * sizeof(Node)) / next : 0.0;
+    }
+};
+
+vector<int> loadSequenceFromFile(const string &filename)
+{
+    vector<int> sequence;
+    ifstream file(filename);
+    int key;
+    while (file >> key)
+    {
+        sequence.push_back(key);
+    }
+    return sequence;
+}
+
+// Binary trace format: this header followed by count little-endian int32 keys.
+struct TraceHeader
+{
+    char magic[8]; // "BSTTRACE"
+    uint32_t version;
+    uint32_t key_bytes;
+    uint64_t count;
+};
+
+static const char TRACE_MAGIC[8] = {'B', 'S', 'T', 'T', 'R', 'A', 'C', 'E'};
+
+bool writeTrace(const string &filename, KeySpan keys)
+{
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.key_bytes = sizeof(int32_t);
+    header.count = keys.size();
+
+    ofstream file(filename, ios::binary);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(keys.begin()), keys.size() * sizeof(int32_t));
+    return static_cast<bool>(file);
+}
+
+// A trace of keys. Binary trace files are mapped read-only and used in place;
+// text files, and sequences generated in memory, are held in a vector. Passes over
+// the trace go through forEachChunk, which hands out the keys a chunk at a time and
+// drops the mapped pages behind it, so a trace larger than RAM streams through a
+// bounded amount of resident memory.
+class MappedTrace
+{
+public:
+    static constexpr size_t CHUNK_KEYS = size_t(1) << 22;
+
+    explicit MappedTrace(vector<int> keys) : owned(std::move(keys))
+    {
+        data = owned.data();
+        count = owned.size();
+    }
+
+    explicit MappedTrace(const string &filename)
+    {
+        if (!mapBinary(filename))
+        {
+            owned = loadSequenceFromFile(filename);
+            data = owned.data();
+            count = owned.size();
+        }
+    }
+
+    MappedTrace(const MappedTrace &) = delete;
+    MappedTrace &operator=(const MappedTrace &) = delete;
+
+    ~MappedTrace()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapping)
+            munmap(mapping, mappingBytes);
+#endif
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    template <typename F>
+    void forEachChunk(F fn) const
+    {
+        for (size_t offset = 0; offset < count; offset += CHUNK_KEYS)
+        {
+            fn(KeySpan(data + offset, min(CHUNK_KEYS, count - offset)));
+            release(offset + min(CHUNK_KEYS, count - offset));
+        }
+    }
+
+private:
+    const int *data = nullptr;
+    size_t count = 0;
+    vector<int> owned;
+    void *mapping = nullptr;
+    size_t mappingBytes = 0;
+
+    bool mapBinary(const string &filename)
+    {
+        TraceHeader header;
+        {
+            ifstream file(filename, ios::binary);
+            if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+                memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+                return false;
+            if (header.version != 1 || header.key_bytes != sizeof(int32_t))
+            {
+                cerr << filename << ": unsupported trace version\n";
+                return true;
+            }
+        }
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 ||
+            static_cast<uint64_t>(st.st_size) < sizeof(header) + header.count * sizeof(int32_t))
+        {
+            cerr << filename << ": truncated trace\n";
+            if (fd >= 0)
+                close(fd);
+            return true;
+        }
+        mappingBytes = st.st_size;
+        void *m = mmap(nullptr, mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED)
+        {
+            cerr << filename << ": mmap failed\n";
+            mappingBytes = 0;
+            return true;
+        }
+        mapping = m;
+        madvise(mapping, mappingBytes, MADV_SEQUENTIAL);
+        data = reinterpret_cast<const int *>(static_cast<const char *>(mapping) + sizeof(header));
+        count = header.count;
+#else
+        ifstream file(filename, ios::binary);
+        file.seekg(sizeof(header));
+        owned.resize(header.count);
+        file.read(reinterpret_cast<char *>(owned.data()), header.count * sizeof(int32_t));
+        data = owned.data();
+        count = header.count;
+#endif
+        return true;
+    }
+
+    // Lets the kernel drop the mapped pages holding keys [0, upto).
+    void release(size_t upto) const
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (!mapping)
+            return;
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t bytes = (sizeof(TraceHeader) + upto * sizeof(int32_t)) / page * page;
+        if (bytes > 0)
+            madvise(mapping, bytes, MADV_DONTNEED);
+#else
+        (void)upto;
+#endif
+    }
+};
+
+// Native ports of the access patterns in generator.py. They draw from rng where
+// the Python version uses random, so a fixed seed gives reproducible traces.
+// Returns an empty sequence for an unknown type or an invalid size.
+vector<int> generatePattern(const string &type, int n, mt19937_64 &rng, int hotspots = 5, double ratio = 0.8)
+{
+    vector<int> seq;
+    if (n <= 0)
+        return seq;
+    seq.reserve(n);
+
+    if (type == "monotonic_inc" || type == "monotonic_dec")
+    {
+        for (int i = 1; i <= n; i++)
+            seq.push_back(type == "monotonic_inc" ? i : n + 1 - i);
+    }
+    else if (type == "random")
+    {
+        for (int i = 1; i <= n; i++)
+            seq.push_back(i);
+        shuffle(seq.begin(), seq.end(), rng);
+    }
+    else if (type == "bit_reversal")
+    {
+        if (n & (n - 1))
+            return seq;
+        int bits = 0;
+        while ((1 << bits) < n)
+            bits++;
+        for (int i = 0; i < n; i++)
+        {
+            int r = 0;
+            for (int b = 0, v = i; b < bits; b++, v >>= 1)
+                r = (r << 1) | (v & 1);
+            seq.push_back(r + 1);
+        }
+    }
+    else if (type == "hotspot")
+    {
+        vector<int> keys(n);
+        for (int i = 0; i < n; i++)
+            keys[i] = i + 1;
+        int h = min(hotspots, n);
+        for (int i = 0; i < h; i++)
+            swap(keys[i], keys[uniform_int_distribution<int>(i, n - 1)(rng)]);
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        uniform_int_distribution<int> pickHot(0, h - 1);
+        uniform_int_distribution<int> pickAny(1, n + 1);
+        for (int i = 0; i < n; i++)
+            seq.push_back(coin(rng) < ratio ? keys[pickHot(rng)] : pickAny(rng));
+    }
+    else if (type == "zigzag")
+    {
+        for (int left = 1, right = n; left <= right;)
+        {
+            seq.push_back(left++);
+            if (left <= right)
+                seq.push_back(right--);
+        }
+    }
+    return seq;
+}
+
+bool fileExists(const string &filename)
+{
+    return static_cast<bool>(ifstream(filename));
+}
+
+// Prefers the binary trace <base>.bin over the text trace <base>.txt.
+string traceFile(const string &base)
+{
+    return fileExists(base + ".bin") ? base + ".bin" : base + ".txt";
+}
+
+// Wilber I (interleave bound): every access flips the preferred side of the
+// reference nodes on its path, and each flip away from a previously set side is
+// one unit of the bound. An unsuccessful search counts as an access to the last
+// node on its path.
+class WilberLowerBound
+{
+private:
+    ReferenceTree *tree;
+
+public:
+    WilberLowerBound(ReferenceTree *ref) : tree(ref) {}
+
+    int computeTurnings(int key)
+    {
+        int turning_points = 0;
+        uint32_t node = tree->root;
+        while (node != NIL)
+        {
+            ReferenceNode &n = tree->at(node);
+            uint32_t next = (key < n.key) ? n.left : (key > n.key) ? n.right : NIL;
+            uint8_t side = (next != NIL && next == n.right) ? PREF_RIGHT : PREF_LEFT;
+            if (n.preferred != PREF_NONE && n.preferred != side)
+                turning_points++;
+            n.preferred = side;
+            node = next;
+        }
+        return turning_points;
+    }
+};
+
+// Geometric view of the access sequence: access i to key x is the point (x, i).
+// For each key rank this max segment tree holds the latest time at which the key
+// carries a point (-1 if none). The points visible from a new access (x, i), i.e.
+// those spanning an empty rectangle with it, form a staircase on either side of x:
+// walking away from x, each next visible key is the first one whose time exceeds
+// every time seen so far. Each step of that walk is one O(log n) descent.
+class LastTouchTree
+{
+public:
+    explicit LastTouchTree(int n) : leaves(1)
+    {
+        while (leaves < n)
+            leaves <<= 1;
+        t.assign(2 * leaves, -1);
+    }
+
+    int get(int i) const { return t[leaves + i]; }
+
+    // Times only grow, so the new time is the maximum on the whole leaf-to-root
+    // path, and the climb stops at the first ancestor another key already raised.
+    void touch(int i, int time)
+    {
+        for (i += leaves; i > 0 && t[i] != time; i >>= 1)
+            t[i] = time;
+    }
+
+    // Smallest rank > pos whose time exceeds threshold, or -1. Climbs from the leaf
+    // until a right sibling holds a larger time, then descends into it, so a step
+    // to a nearby key stays cheap.
+    int nextAbove(int pos, int threshold) const
+    {
+        if (pos + 1 >= leaves)
+            return -1;
+        int i = leaves + pos + 1;
+        while (t[i] <= threshold)
+        {
+            while (i > 1 && (i & 1))
+                i >>= 1;
+            if (i == 1)
+                return -1;
+            i++;
+        }
+        while (i < leaves)
+        {
+            i = 2 * i;
+            if (t[i] <= threshold)
+                i++;
+        }
+        return i - leaves;
+    }
+
+    // Largest rank < pos whose time exceeds threshold, or -1.
+    int prevAbove(int pos, int threshold) const
+    {
+        if (pos <= 0)
+            return -1;
+        int i = leaves + pos - 1;
+        while (t[i] <= threshold)
+        {
+            while (i > 1 && !(i & 1))
+                i >>= 1;
+            if (i == 1)
+                return -1;
+            i--;
+        }
+        while (i < leaves)
+        {
+            i = 2 * i + 1;
+            if (t[i] <= threshold)
+                i--;
+        }
+        return i - leaves;
+    }
+
+private:
+    int leaves;
+    vector<int> t;
+};
+
+// Keys of an access sequence mapped to dense ranks for LastTouchTree.
+class KeyRanks
+{
+public:
+    // Deduplicates chunk by chunk, so memory stays bounded by the distinct keys.
+    explicit KeyRanks(const MappedTrace &access_sequence)
+    {
+        access_sequence.forEachChunk([&](KeySpan chunk)
+        {
+            keys.insert(keys.end(), chunk.begin(), chunk.end());
+            sort(keys.begin(), keys.end());
+            keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        });
+    }
+
+    int size() const { return static_cast<int>(keys.size()); }
+    int rank(int key) const { return static_cast<int>(lower_bound(keys.begin(), keys.end(), key) - keys.begin()); }
+
+private:
+    vector<int> keys;
+};
+
+// Wilber II (funnel bound): the funnel of access (x, i) is the set of earlier
+// access points visible from it. Ordered by time, its points fall left or right
+// of x, and every switch of side is one unit of the bound.
+class FunnelLowerBound
+{
+private:
+    KeyRanks ranks;
+    LastTouchTree last;
+    vector<int> leftTimes, rightTimes;
+    int time = 0;
+
+public:
+    FunnelLowerBound(const MappedTrace &access_sequence) : ranks(access_sequence), last(ranks.size()) {}
+
+    int computeAlternations(int key)
+    {
+        int x = ranks.rank(key);
+        int floor = last.get(x); // an earlier access to x hides everything older
+
+        leftTimes.clear();
+        rightTimes.clear();
+        for (int y = last.prevAbove(x, floor), m = floor; y != -1; y = last.prevAbove(y, m))
+        {
+            m = last.get(y);
+            leftTimes.push_back(m);
+        }
+        for (int y = last.nextAbove(x, floor), m = floor; y != -1; y = last.nextAbove(y, m))
+        {
+            m = last.get(y);
+            rightTimes.push_back(m);
+        }
+
+        // Both staircases are collected in increasing time; merge and count side switches.
+        int alternations = 0;
+        size_t l = 0, r = 0;
+        int side = -1;
+        while (l < leftTimes.size() || r < rightTimes.size())
+        {
+            int next = (r == rightTimes.size() || (l < leftTimes.size() && leftTimes[l] < rightTimes[r])) ? 0 : 1;
+            if (next == 0)
+                l++;
+            else
+                r++;
+            if (side != -1 && side != next)
+                alternations++;
+            side = next;
+        }
+
+        last.touch(x, time++);
+        return alternations;
+    }
+};
+
+// Offline Greedy BST (Lucas, Munro) in the geometric view: at each access it touches
+// the accessed key plus every key on the two staircases visible from it, which is
+// the minimal set of points that keeps the point set arborally satisfied. The
+// number of touched points is Greedy's cost, conjectured to be within a constant
+// factor of the offline optimum.
+class GreedyUpperBound
+{
+private:
+    KeyRanks ranks;
+    LastTouchTree last;
+    vector<int> touched;
+    int time = 0;
+
+public:
+    GreedyUpperBound(const MappedTrace &access_sequence) : ranks(access_sequence), last(ranks.size()) {}
+
+    int computeTouched(int key)
+    {
+        int x = ranks.rank(key);
+        int floor = last.get(x);
+
+        touched.assign(1, x);
+        for (int y = last.prevAbove(x, floor), m = floor; y != -1; y = last.prevAbove(y, m))
+        {
+            m = last.get(y);
+            touched.push_back(y);
+        }
+        for (int y = last.nextAbove(x, floor), m = floor; y != -1; y = last.nextAbove(y, m))
+        {
+            m = last.get(y);
+            touched.push_back(y);
+        }
+
+        for (int y : touched)
+            last.touch(y, time);
+        time++;
+        return static_cast<int>(touched.size());
+    }
+};
+
+struct Operation
+{
+    char type; // 'I'nsert, 'S'earch or 'D'elete
+    int key;
+};
+
+// Reads an operation trace of whitespace-separated "<type> <key>" pairs.
+vector<Operation> loadOperationsFromFile(const string &filename)
+{
+    vector<Operation> operations;
+    ifstream file(filename);
+    Operation op;
+    while (file >> op.type >> op.key)
+    {
+        operations.push_back(op);
+    }
+    return operations;
+}
+
+// Counts hardware events of the calling thread between start() and stop() through
+// perf_event_open, in user space only. Each event is opened on its own rather than
+// as a group, so that the kernel can multiplex them when there are more events than
+// counters; counts are scaled up by the fraction of the time they were scheduled.
+// Events that cannot be opened (no PMU in a VM, perf_event_paranoid, other systems)
+// are reported as -1 and the run goes on without them.
+class HardwareCounters
+{
+public:
+    HardwareCounters()
+    {
+#if defined(__linux__)
+        const pair<uint32_t, uint64_t> events[HardwareCounts::EVENTS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cacheMisses(PERF_COUNT_HW_CACHE_L1D)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, cacheMisses(PERF_COUNT_HW_CACHE_DTLB)},
+        };
+        for (int e = 0; e < HardwareCounts::EVENTS; e++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[e].first;
+            attr.config = events[e].second;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~HardwareCounters()
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    HardwareCounters(const HardwareCounters &) = delete;
+    HardwareCounters &operator=(const HardwareCounters &) = delete;
+
+    bool available() const
+    {
+        return any_of(begin(fds), end(fds), [](int fd) { return fd >= 0; });
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    HardwareCounts stop()
+    {
+        HardwareCounts counts;
+#if defined(__linux__)
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (int e = 0; e < HardwareCounts::EVENTS; e++)
+        {
+            uint64_t value[3]; // count, time enabled, time running
+            if (fds[e] < 0 || read(fds[e], value, sizeof(value)) != sizeof(value) || value[2] == 0)
+                continue;
+            counts.count[e] = static_cast<int64_t>(static_cast<double>(value[0]) * value[1] / value[2]);
+        }
+#endif
+        return counts;
+    }
+
+private:
+#if defined(__linux__)
+    static uint64_t cacheMisses(uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+    int fds[HardwareCounts::EVENTS] = {-1, -1, -1, -1, -1, -1};
+};
+
+// Log-bucketed histogram in the manner of HdrHistogram. Values below 2^SUB_BITS get
+// a bucket each; every higher power-of-two range is split into 2^SUB_BITS linear
+// sub-buckets, so a value is resolved to within 1/2^SUB_BITS (6.25%) of itself in
+// a fixed 8 KB of counts. Percentiles report the upper end of their bucket.
+class LogHistogram
+{
+public:
+    void record(uint64_t value)
+    {
+        counts[bucketOf(value)]++;
+        total++;
+        largest = std::max(largest, value);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return largest; }
+
+    // Smallest bucket bound that at least p percent of the values do not exceed.
+    uint64_t percentile(double p) const
+    {
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++)
+        {
+            seen += counts[b];
+            if (seen >= std::max<uint64_t>(rank, 1))
+                return std::min(upperBound(b), largest);
+        }
+        return largest;
+    }
+
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1u << SUB_BITS;
+    static constexpr size_t BUCKETS = 64 * SUB_BUCKETS;
+
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperBound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+        uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t largest = 0;
+};
+
+// Timer for single accesses. On x86 it reads the TSC and converts ticks to
+// nanoseconds at a rate calibrated once against steady_clock; elsewhere it reads
+// steady_clock itself. The cost of two back-to-back reads is measured at the same
+// time and subtracted from every interval.
+class AccessTimer
+{
+public:
+    static const AccessTimer &calibrated()
+    {
+        static const AccessTimer timer;
+        return timer;
+    }
+
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    uint64_t nanoseconds(uint64_t start, uint64_t end) const
+    {
+        uint64_t ticks = end - start;
+        ticks = (ticks > overhead) ? ticks - overhead : 0;
+        return static_cast<uint64_t>(ticks * ns_per_tick + 0.5);
+    }
+
+private:
+    AccessTimer()
+    {
+        auto wall_start = chrono::steady_clock::now();
+        uint64_t tick_start = now();
+        while (chrono::steady_clock::now() - wall_start < chrono::milliseconds(20))
+        {
+        }
+        auto wall_end = chrono::steady_clock::now();
+        uint64_t tick_end = now();
+        double ns = chrono::duration<double, nano>(wall_end - wall_start).count();
+        ns_per_tick = (tick_end > tick_start) ? ns / (tick_end - tick_start) : 1.0;
+
+        overhead = UINT64_MAX;
+        for (int i = 0; i < 1000; i++)
+        {
+            uint64_t start = now();
+            overhead = std::min(overhead, now() - start);
+        }
+    }
+
+    double ns_per_tick = 1.0;
+    uint64_t overhead = 0;
+};
+
+// Per-access profile of a run: the latency histogram, and for each path length
+// the number of accesses and their summed latency, so that the two can be set
+// against each other.
+struct LatencyProfile
+{
+    LogHistogram latency;
+    vector<uint64_t> depth_count;
+    vector<double> depth_ns;
+
+    void record(uint64_t ns, size_t depth)
+    {
+        latency.record(ns);
+        if (depth >= depth_count.size())
+        {
+            depth_count.resize(depth + 1);
+            depth_ns.resize(depth + 1);
+        }
+        depth_count[depth]++;
+        depth_ns[depth] += ns;
+    }
+
+    double meanDepth() const
+    {
+        double sum = 0.0;
+        for (size_t d = 0; d < depth_count.size(); d++)
+            sum += static_cast<double>(d) * depth_count[d];
+        return latency.count() ? sum / latency.count() : 0.0;
+    }
+};
+
+// One sampled access of an AccessTrace. depth is the access's path length, read
+// off the counters like in measureLatency; switches counts the auxiliary trees the
+// access joined into the top path (path-based trees only).
+struct AccessRecord
+{
+    uint64_t index; // position in the access sequence
+    int32_t key;
+    uint32_t depth;
+    uint32_t rotations;
+    uint32_t switches;
+};
+
+// Binary access trace file: this header, then records AccessRecords oldest first,
+// then snapshots blocks of {uint64_t index, uint64_t levels, levels x uint64_t
+// nodes at each depth}. All fields are little-endian.
+struct AccessTraceHeader
+{
+    char magic[8]; // "BSTACCES"
+    uint32_t version;
+    uint32_t record_bytes;
+    uint64_t period;    // one access in period was sampled
+    uint64_t records;
+    uint64_t dropped;   // sampled records overwritten in the ring before the end
+    uint64_t snapshots;
+};
+
+static const char ACCESS_TRACE_MAGIC[8] = {'B', 'S', 'T', 'A', 'C', 'C', 'E', 'S'};
+
+// Sampled trace of a run. Every period-th access is written into a ring buffer
+// allocated up front, which keeps the latest capacity records, and every
+// snapshot_period accesses the tree's node-depth histogram is kept as well.
+// Nothing touches the disk before save(). The runner traces only the counting
+// run, whose time is not reported, and checks for a trace once per run rather
+// than per access.
+class AccessTrace
+{
+public:
+    AccessTrace(uint64_t period, size_t capacity, uint64_t snapshot_period)
+        : period(max<uint64_t>(period, 1)), snapshot_period(max<uint64_t>(snapshot_period, 1)), ring(max<size_t>(capacity, 1)),
+          until_sample(1), until_snapshot(this->snapshot_period)
+    {
+    }
+
+    // Whether the next access is sampled; call once per access.
+    bool sample()
+    {
+        if (--until_sample)
+            return false;
+        until_sample = period;
+        return true;
+    }
+
+    void record(const AccessRecord &r)
+    {
+        ring[written % ring.size()] = r;
+        written++;
+    }
+
+    // Returns the histogram to fill if a snapshot is due after this access, else
+    // nullptr; call once per access.
+    vector<uint64_t> *snapshot(uint64_t index)
+    {
+        if (--until_snapshot)
+            return nullptr;
+        until_snapshot = snapshot_period;
+        snapshots.push_back({index, {}});
+        return &snapshots.back().second;
+    }
+
+    bool save(const string &filename) const
+    {
+        size_t kept = min<uint64_t>(written, ring.size());
+        AccessTraceHeader header;
+        memcpy(header.magic, ACCESS_TRACE_MAGIC, sizeof(header.magic));
+        header.version = 1;
+        header.record_bytes = sizeof(AccessRecord);
+        header.period = period;
+        header.records = kept;
+        header.dropped = written - kept;
+        header.snapshots = snapshots.size();
+
+        ofstream file(filename, ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        size_t first = (written - kept) % ring.size();
+        size_t tail = min(kept, ring.size() - first);
+        file.write(reinterpret_cast<const char *>(&ring[first]), tail * sizeof(AccessRecord));
+        file.write(reinterpret_cast<const char *>(ring.data()), (kept - tail) * sizeof(AccessRecord));
+        for (const auto &snap : snapshots)
+        {
+            uint64_t levels = snap.second.size();
+            file.write(reinterpret_cast<const char *>(&snap.first), sizeof(uint64_t));
+            file.write(reinterpret_cast<const char *>(&levels), sizeof(levels));
+            file.write(reinterpret_cast<const char *>(snap.second.data()), levels * sizeof(uint64_t));
+        }
+        return static_cast<bool>(file);
+    }
+
+    uint64_t recorded() const { return written; }
+
+private:
+    uint64_t period;
+    uint64_t snapshot_period;
+    vector<AccessRecord> ring;
+    uint64_t written = 0;
+    uint64_t until_sample;
+    uint64_t until_snapshot;
+    vector<pair<uint64_t, vector<uint64_t>>> snapshots;
+};
+
+// Records kept by the ring of each traced run, and depth snapshots taken over it.
+constexpr size_t TRACE_CAPACITY = 1 << 20;
+constexpr uint64_t TRACE_SNAPSHOTS = 32;
+
+// Builds the tree called name with the given metrics policy and hands it to fn
+// as its concrete type, so that fn's calls into the tree dispatch statically.
+// Returns false for an unknown name.
+template <typename Metrics, typename F>
+bool withTree(const string &name, F fn)
+{
+    if (name == "BasicBST")
+        fn(*make_unique<BasicBST<Metrics>>());
+    else if (name == "SplayTree")
+        fn(*make_unique<SplayTree<Metrics>>());
+    else if (name == "SemiSplay")
+        fn(*make_unique<SplayTree<Metrics>>(SPLAY_SEMI));
+    else if (name == "DepthSplay")
+        fn(*make_unique<SplayTree<Metrics>>(SPLAY_DEPTH));
+    else if (name == "EveryKSplay")
+        fn(*make_unique<SplayTree<Metrics>>(SPLAY_EVERY_K));
+    else if (name == "RandomSplay")
+        fn(*make_unique<SplayTree<Metrics>>(SPLAY_RANDOM));
+    else if (name == "TangoTree")
+        fn(*make_unique<TangoTree<Metrics>>());
+    else if (name == "MultiSplay")
+        fn(*make_unique<MultiSplayTree<Metrics>>());
+    else if (name == "FingerSkipList")
+        fn(*make_unique<FingerSkipList<Metrics>>());
+    else if (name == "Eytzinger")
+        fn(*make_unique<EytzingerTree<Metrics>>());
+    else if (name == "VanEmdeBoas")
+        fn(*make_unique<VanEmdeBoasTree<Metrics>>());
+    else if (name == "BPlusTree")
+        fn(*make_unique<BPlusTree<Metrics>>());
+    else if (name == "OptimisticSplay")
+        fn(*make_unique<OptimisticSplayTree<Metrics>>());
+    else
+        return false;
+    return true;
+}
+
+// Receives the hit count of each timed loop, so that searches without counters
+// are not optimized away. Atomic because the matrix and scaling workers store to
+// it concurrently.
+atomic<size_t> searchHits(0);
+
+// Access loop that also feeds trace. Path lengths come from the counters, so only
+// the counting policy gives meaningful records.
+template <typename Tree>
+size_t traceAccesses(Tree &tree, const MappedTrace &access_sequence, AccessTrace &trace)
+{
+    size_t found = 0;
+    uint64_t index = 0;
+    access_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+        {
+            if (trace.sample())
+            {
+                int64_t comparisons = tree.metrics.total_comparisons;
+                int64_t visits = tree.metrics.total_node_visits;
+                int64_t rotations = tree.metrics.total_rotations;
+                int64_t switches = tree.metrics.total_path_switches;
+                found += tree.search(key);
+                visits = tree.metrics.total_node_visits - visits;
+                comparisons = tree.metrics.total_comparisons - comparisons;
+                trace.record({index, key, static_cast<uint32_t>(visits > 0 ? visits : comparisons),
+                              static_cast<uint32_t>(tree.metrics.total_rotations - rotations),
+                              static_cast<uint32_t>(tree.metrics.total_path_switches - switches)});
+            }
+            else
+                found += tree.search(key);
+            if (vector<uint64_t> *depths = trace.snapshot(index))
+                tree.nodeDepths(*depths);
+            index++;
+        }
+    });
+    return found;
+}
+
+// Loads insert_sequence, then times the access loop, sampling it into trace if
+// one is given.
+template <typename Tree>
+void measureAccesses(Tree &tree, const MappedTrace &insert_sequence, const MappedTrace &access_sequence, AccessTrace *trace = nullptr)
+{
+    insert_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+            tree.insert(key);
+    });
+    tree.prepare();
 
-class WilberLowerBound
+    HardwareCounters counters;
+    size_t found = 0;
+    counters.start();
+    auto start = chrono::high_resolution_clock::now();
+    if (trace)
+        found = traceAccesses(tree, access_sequence, *trace);
+    else
+    {
+        access_sequence.forEachChunk([&](KeySpan chunk)
+        {
+            for (int key : chunk)
+                found += tree.search(key);
+        });
+    }
+    auto end = chrono::high_resolution_clock::now();
+    tree.metrics.hardware = counters.stop();
+    searchHits.store(found, memory_order_relaxed);
+
+    tree.metrics.total_time = chrono::duration<double, milli>(end - start).count();
+    tree.metrics.bytes_per_node = tree.bytesPerNode();
+}
+
+// Counts with the counting policy, then takes the execution time and hardware
+// counts from a second run of the uninstrumented tree. Prints nothing, so that it can run from the
+// matrix workers. A trace, if given, samples the counting run.
+BSTMetrics measureTree(const string &name, const MappedTrace &insert_sequence, const MappedTrace &access_sequence,
+                       AccessTrace *trace = nullptr)
 {
-private:
-    ReferenceTree *tree;
-    unordered_set<pair<int, int>, hash_pair> last_path_edges;
+    BSTMetrics result;
+    withTree<BSTMetrics>(name, [&](auto &tree)
+    {
+        measureAccesses(tree, insert_sequence, access_sequence, trace);
+        result = tree.metrics;
+    });
+    withTree<NoMetrics>(name, [&](auto &tree)
+    {
+        measureAccesses(tree, insert_sequence, access_sequence);
+        result.total_time = tree.metrics.total_time;
+        result.hardware = tree.metrics.hardware;
+    });
+    return result;
+}
 
-public:
-    WilberLowerBound(ReferenceTree *ref) : tree(ref) {}
+// Keys handed to one searchBatch call by the batched runner.
+constexpr size_t BATCH_KEYS = 1024;
 
-    void extractEdges(ReferenceNode *node, unordered_set<pair<int, int>, hash_pair> &edges)
+// Loads insert_sequence into the uninstrumented tree, then times the access loop
+// run through searchBatch. Returns the time in ms.
+double measureBatchedTime(const string &name, const MappedTrace &insert_sequence, const MappedTrace &access_sequence)
+{
+    double time = 0.0;
+    withTree<NoMetrics>(name, [&](auto &tree)
     {
-        while (node->parent)
+        insert_sequence.forEachChunk([&](KeySpan chunk)
         {
-            int u = node->parent->key;
-            int v = node->key;
-            edges.insert({min(u, v), max(u, v)});
-            node = node->parent;
-        }
-    }
+            for (int key : chunk)
+                tree.insert(key);
+        });
+        tree.prepare();
 
-    int computeTurnings(int key)
+        bool out[BATCH_KEYS];
+        size_t found = 0;
+        auto start = chrono::high_resolution_clock::now();
+        access_sequence.forEachChunk([&](KeySpan chunk)
+        {
+            for (size_t i = 0; i < chunk.size(); i += BATCH_KEYS)
+            {
+                KeySpan batch(chunk.first + i, min(BATCH_KEYS, chunk.size() - i));
+                tree.searchBatch(batch, out);
+                found += count(out, out + batch.size(), true);
+            }
+        });
+        auto end = chrono::high_resolution_clock::now();
+        searchHits.store(found, memory_order_relaxed);
+        time = chrono::duration<double, milli>(end - start).count();
+    });
+    return time;
+}
+
+// Width in keys of each scan of the range runner.
+constexpr int RANGE_SPAN = 64;
+
+struct RangeResult
+{
+    BSTMetrics metrics;
+    size_t scans = 0;
+    size_t keys = 0; // keys reported over all scans
+};
+
+// Loads insert_sequence, then times a scan of [x, x + RANGE_SPAN - 1] for every key
+// x of the access sequence. Returns the number of keys reported.
+template <typename Tree>
+size_t measureScans(Tree &tree, const MappedTrace &insert_sequence, const MappedTrace &access_sequence)
+{
+    insert_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+            tree.insert(key);
+    });
+    tree.prepare();
+
+    size_t keys = 0;
+    int64_t sum = 0;
+    function<void(int)> visit = [&](int key)
+    {
+        sum += key;
+    };
+    auto start = chrono::high_resolution_clock::now();
+    access_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+            keys += tree.rangeScan(key, (key > INT_MAX - (RANGE_SPAN - 1)) ? INT_MAX : key + (RANGE_SPAN - 1), visit);
+    });
+    auto end = chrono::high_resolution_clock::now();
+    searchHits.store(keys + static_cast<size_t>(sum), memory_order_relaxed);
+
+    tree.metrics.total_time = chrono::duration<double, milli>(end - start).count();
+    return keys;
+}
+
+// Range-scan pass over the access sequence, counted and timed as in measureTree.
+RangeResult measureRangeScans(const string &name, const MappedTrace &insert_sequence, const MappedTrace &access_sequence)
+{
+    RangeResult result;
+    result.scans = access_sequence.size();
+    withTree<BSTMetrics>(name, [&](auto &tree)
     {
-        unordered_set<pair<int, int>, hash_pair> current_edges;
-        ReferenceNode *node = tree->root;
+        result.keys = measureScans(tree, insert_sequence, access_sequence);
+        result.metrics = tree.metrics;
+    });
+    withTree<NoMetrics>(name, [&](auto &tree)
+    {
+        measureScans(tree, insert_sequence, access_sequence);
+        result.metrics.total_time = tree.metrics.total_time;
+    });
+    return result;
+}
 
-        while (node && node->key != key)
+// Times each search of the access loop on its own on the uninstrumented tree. The
+// path length of each search comes from a separate pass of the counting policy
+// and is paired with the latency by access index: nodes visited where the tree
+// counts them, else comparisons.
+LatencyProfile measureLatency(const string &name, const MappedTrace &insert_sequence, const MappedTrace &access_sequence)
+{
+    const AccessTimer &timer = AccessTimer::calibrated();
+    LatencyProfile profile;
+    vector<uint32_t> depths;
+    depths.reserve(access_sequence.size());
+    withTree<BSTMetrics>(name, [&](auto &tree)
+    {
+        insert_sequence.forEachChunk([&](KeySpan chunk)
         {
-            if (key < node->key)
-                node = node->left;
-            else
-                node = node->right;
-        }
-        if (!node)
-            return 0;
+            for (int key : chunk)
+                tree.insert(key);
+        });
+        tree.prepare();
 
-        extractEdges(node, current_edges);
+        access_sequence.forEachChunk([&](KeySpan chunk)
+        {
+            for (int key : chunk)
+            {
+                int64_t comparisons = tree.metrics.total_comparisons;
+                int64_t visits = tree.metrics.total_node_visits;
+                tree.search(key);
+                visits = tree.metrics.total_node_visits - visits;
+                comparisons = tree.metrics.total_comparisons - comparisons;
+                depths.push_back(static_cast<uint32_t>(visits > 0 ? visits : comparisons));
+            }
+        });
+    });
+    withTree<NoMetrics>(name, [&](auto &tree)
+    {
+        insert_sequence.forEachChunk([&](KeySpan chunk)
+        {
+            for (int key : chunk)
+                tree.insert(key);
+        });
+        tree.prepare();
 
-        int turning_points = 0;
-        for (const auto &e : current_edges)
+        size_t found = 0, index = 0;
+        access_sequence.forEachChunk([&](KeySpan chunk)
         {
-            if (last_path_edges.find(e) == last_path_edges.end())
+            for (int key : chunk)
             {
-                turning_points++;
+                uint64_t start = AccessTimer::now();
+                found += tree.search(key);
+                uint64_t end = AccessTimer::now();
+                profile.record(timer.nanoseconds(start, end), depths[index++]);
             }
-        }
+        });
+        searchHits.store(found, memory_order_relaxed);
+    });
+    return profile;
+}
 
-        last_path_edges = std::move(current_edges);
-        return turning_points;
+void printLatency(const LatencyProfile &p)
+{
+    cout << "Latency p50/p99/p99.9/max: " << p.latency.percentile(50) << " / " << p.latency.percentile(99) << " / "
+         << p.latency.percentile(99.9) << " / " << p.latency.max() << " ns" << endl;
+    cout << "Mean Path Length: " << p.meanDepth() << endl;
+}
+
+// One row per path length: how many accesses had it and their mean latency.
+void saveDepthProfileToCSV(const string &filename, const LatencyProfile &profile)
+{
+    ofstream file(filename);
+    file << "Depth,Accesses,MeanLatencyNs\n";
+    for (size_t d = 0; d < profile.depth_count.size(); d++)
+    {
+        if (profile.depth_count[d] > 0)
+            file << d << "," << profile.depth_count[d] << "," << profile.depth_ns[d] / profile.depth_count[d] << "\n";
     }
-};
+}
 
-vector<int> loadSequenceFromFile(const string &filename)
+void printMetrics(const BSTMetrics &m)
 {
-    vector<int> sequence;
-    ifstream file(filename);
-    int key;
-    while (file >> key)
+    cout << "Comparisons: " << m.total_comparisons << endl;
+    cout << "Rotations: " << m.total_rotations << endl;
+    if (m.total_node_visits > 0)
+        cout << "Node Visits: " << m.total_node_visits << endl;
+    cout << "Execution Time: " << m.total_time << " ms" << endl;
+    cout << "Bytes/Node: " << m.bytes_per_node << endl;
+    for (int e = 0; e < HardwareCounts::EVENTS; e++)
     {
-        sequence.push_back(key);
+        if (m.hardware.count[e] >= 0)
+            cout << HardwareCounts::NAMES[e] << ": " << m.hardware.count[e] << endl;
+    }
+}
+
+// CSV columns for the hardware counts. Counts that were not available are left empty.
+string hardwareCSVHeader()
+{
+    string header;
+    for (const char *name : HardwareCounts::NAMES)
+        header += string(",") + name;
+    return header;
+}
+
+void writeHardwareCSV(ostream &file, const HardwareCounts &hardware)
+{
+    for (int64_t count : hardware.count)
+    {
+        file << ",";
+        if (count >= 0)
+            file << count;
     }
-    return sequence;
 }
 
-void runExperiment(BST *tree, const vector<int> &insert_sequence, const vector<int> &access_sequence)
+BSTMetrics runExperiment(const string &name, const MappedTrace &insert_sequence, const MappedTrace &access_sequence,
+                         AccessTrace *trace = nullptr)
+{
+    BSTMetrics result = measureTree(name, insert_sequence, access_sequence, trace);
+    printMetrics(result);
+    return result;
+}
+
+void saveResultsToCSV(const string &filename, const string &algorithm_name, const BSTMetrics &result)
 {
-    tree->metrics = BSTMetrics();
+    ofstream file(filename);
+    file << "Algorithm,Comparisons,Rotations,NodeVisits,ExecutionTime,BytesPerNode" << hardwareCSVHeader() << "\n";
+    file << algorithm_name << "," << result.total_comparisons << "," << result.total_rotations << "," << result.total_node_visits << "," << result.total_time << "," << result.bytes_per_node;
+    writeHardwareCSV(file, result.hardware);
+    file << "\n";
+}
 
-    for (int key : insert_sequence)
-        tree->insert(key);
+// Loads insert_sequence untimed, then times the interleaved operation trace.
+template <typename Tree>
+void measureOperations(Tree &tree, const MappedTrace &insert_sequence, const vector<Operation> &operations)
+{
+    insert_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+            tree.insert(key);
+    });
+    tree.prepare();
+    tree.metrics = decltype(tree.metrics)();
 
+    HardwareCounters counters;
+    size_t found = 0;
+    counters.start();
     auto start = chrono::high_resolution_clock::now();
-    for (int key : access_sequence)
-        tree->search(key);
+    for (const Operation &op : operations)
+    {
+        if (op.type == 'I')
+            tree.insert(op.key);
+        else if (op.type == 'D')
+            tree.remove(op.key);
+        else
+            found += tree.search(op.key);
+    }
     auto end = chrono::high_resolution_clock::now();
+    tree.metrics.hardware = counters.stop();
+    searchHits.store(found, memory_order_relaxed);
+
+    tree.metrics.total_time = chrono::duration<double, milli>(end - start).count();
+    tree.metrics.bytes_per_node = tree.bytesPerNode();
+}
+
+BSTMetrics runExperiment(const string &name, const MappedTrace &insert_sequence, const vector<Operation> &operations)
+{
+    BSTMetrics result;
+    withTree<BSTMetrics>(name, [&](auto &tree)
+    {
+        measureOperations(tree, insert_sequence, operations);
+        result = tree.metrics;
+    });
+    withTree<NoMetrics>(name, [&](auto &tree)
+    {
+        measureOperations(tree, insert_sequence, operations);
+        result.total_time = tree.metrics.total_time;
+        result.hardware = tree.metrics.hardware;
+    });
 
-    tree->metrics.total_time = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    cout << "Operations: " << operations.size() << endl;
+    printMetrics(result);
+    return result;
+}
 
-    cout << "Comparisons: " << tree->metrics.total_comparisons << endl;
-    cout << "Rotations: " << tree->metrics.total_rotations << endl;
-    cout << "Execution Time: " << tree->metrics.total_time << " ms" << endl;
+double throughput(size_t operations, const BSTMetrics &result)
+{
+    return (result.total_time > 0) ? operations / result.total_time : 0.0;
 }
 
-void saveResultsToCSV(const string &filename, const string &algorithm_name, const BSTMetrics &result)
+void saveChurnResultsToCSV(const string &filename, const string &algorithm_name, size_t operations, const BSTMetrics &result)
 {
     ofstream file(filename);
-    file << "Algorithm,Comparisons,Rotations,ExecutionTime\n";
-    file << algorithm_name << "," << result.total_comparisons << "," << result.total_rotations << "," << result.total_time << "\n";
+    file << "Algorithm,Operations,Comparisons,Rotations,ExecutionTime,OpsPerMs,BytesPerNode" << hardwareCSVHeader() << "\n";
+    file << algorithm_name << "," << operations << "," << result.total_comparisons << "," << result.total_rotations << "," << result.total_time << "," << throughput(operations, result) << "," << result.bytes_per_node;
+    writeHardwareCSV(file, result.hardware);
+    file << "\n";
+}
+
+vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+// Pins the calling thread to one core so that its timings do not suffer from migrations.
+void pinToCore(unsigned core)
+{
+#if defined(__linux__)
+    unsigned cores = thread::hardware_concurrency();
+    if (cores == 0) // unknown, leave the thread where it is
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+// Runs every tree x pattern x size x repetition cell of the experiment matrix on a
+// pool of pinned worker threads and writes one row per cell to a single CSV. For
+// pattern p and size n the access trace is <dir>/<p>_<n>.bin or .txt and the keys
+// to insert are <dir>/insert_<n>.bin or .txt; missing traces are generated in
+// memory (inserts as a random permutation). Cells are independent; each worker
+// takes the next unclaimed one.
+int runMatrix(int argc, char **argv)
+{
+    vector<string> trees = {"BasicBST", "SplayTree", "TangoTree"};
+    vector<string> patterns = {"random", "monotonic_inc", "hotspot", "zigzag", "bit_reversal"};
+    vector<int> sizes = {1024};
+    int reps = 1;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    string dir = "traces", out = "results_matrix.csv";
+    uint64_t seed = 1;
+    bool latency = false, batched = false;
+
+    for (int i = 2; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (flag == "--latency" || flag == "--batch")
+        {
+            (flag == "--latency" ? latency : batched) = true;
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            cerr << "Missing value for " << flag << "\n";
+            return 1;
+        }
+        string value = argv[++i];
+        if (flag == "--trees")
+            trees = splitList(value);
+        else if (flag == "--patterns")
+            patterns = splitList(value);
+        else if (flag == "--sizes")
+        {
+            sizes.clear();
+            for (const string &size : splitList(value))
+                sizes.push_back(stoi(size));
+        }
+        else if (flag == "--reps")
+            reps = stoi(value);
+        else if (flag == "--threads")
+            threads = max(1, stoi(value));
+        else if (flag == "--traces")
+            dir = value;
+        else if (flag == "--out")
+            out = value;
+        else if (flag == "--seed")
+            seed = stoull(value);
+        else
+        {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    // Traces are loaded or generated once and shared read-only by all cells.
+    mt19937_64 rng(seed);
+    auto openOrGenerate = [&](const string &base, const string &type, int size)
+    {
+        string filename = traceFile(base);
+        if (fileExists(filename))
+            return make_unique<MappedTrace>(filename);
+        return make_unique<MappedTrace>(generatePattern(type, size, rng));
+    };
+    map<int, unique_ptr<MappedTrace>> inserts;
+    map<pair<string, int>, unique_ptr<MappedTrace>> accesses;
+    for (int size : sizes)
+    {
+        inserts[size] = openOrGenerate(dir + "/insert_" + to_string(size), "random", size);
+        for (const string &pattern : patterns)
+        {
+            auto &trace = accesses[{pattern, size}];
+            trace = openOrGenerate(dir + "/" + pattern + "_" + to_string(size), pattern, size);
+            if (trace->empty())
+            {
+                cerr << "No trace for pattern " << pattern << " at size " << size << "\n";
+                return 1;
+            }
+        }
+    }
+
+    struct Cell
+    {
+        string tree;
+        string pattern;
+        int size;
+        int rep;
+        BSTMetrics result;
+        LatencyProfile latency;
+        double batch_time;
+    };
+    vector<Cell> cells;
+    for (int size : sizes)
+        for (const string &pattern : patterns)
+            for (const string &tree : trees)
+                for (int rep = 0; rep < reps; rep++)
+                    cells.push_back({tree, pattern, size, rep, BSTMetrics(), LatencyProfile(), 0.0});
+
+    cout << "Running " << cells.size() << " cells on " << threads << " threads\n";
+    atomic<size_t> nextCell(0);
+    auto work = [&](unsigned core)
+    {
+        pinToCore(core);
+        for (size_t i = nextCell++; i < cells.size(); i = nextCell++)
+        {
+            Cell &cell = cells[i];
+            const MappedTrace &insert_sequence = *inserts.at(cell.size);
+            const MappedTrace &access_sequence = *accesses.at({cell.pattern, cell.size});
+            cell.result = measureTree(cell.tree, insert_sequence, access_sequence);
+            if (latency)
+                cell.latency = measureLatency(cell.tree, insert_sequence, access_sequence);
+            if (batched)
+                cell.batch_time = measureBatchedTime(cell.tree, insert_sequence, access_sequence);
+        }
+    };
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+        workers.emplace_back(work, t);
+    for (auto &worker : workers)
+        worker.join();
+
+    ofstream file(out);
+    file << "Algorithm,Pattern,Size,Rep,Comparisons,Rotations,NodeVisits,ExecutionTime,BytesPerNode" << hardwareCSVHeader();
+    file << (latency ? ",P50Ns,P99Ns,P999Ns,MaxNs,MeanDepth" : "") << (batched ? ",BatchTime\n" : "\n");
+    for (const Cell &cell : cells)
+    {
+        const BSTMetrics &m = cell.result;
+        file << cell.tree << "," << cell.pattern << "," << cell.size << "," << cell.rep << ","
+             << m.total_comparisons << "," << m.total_rotations << "," << m.total_node_visits << ","
+             << m.total_time << "," << m.bytes_per_node;
+        writeHardwareCSV(file, m.hardware);
+        if (latency)
+        {
+            const LogHistogram &h = cell.latency.latency;
+            file << "," << h.percentile(50) << "," << h.percentile(99) << "," << h.percentile(99.9) << "," << h.max() << "," << cell.latency.meanDepth();
+        }
+        if (batched)
+            file << "," << cell.batch_time;
+        file << "\n";
+    }
+    cout << "Matrix results saved to " << out << "\n";
+
+    if (latency)
+    {
+        string depth_out = out.substr(0, out.rfind(".csv")) + "_depth.csv";
+        ofstream depth_file(depth_out);
+        depth_file << "Algorithm,Pattern,Size,Rep,Depth,Accesses,MeanLatencyNs\n";
+        for (const Cell &cell : cells)
+        {
+            const LatencyProfile &p = cell.latency;
+            for (size_t d = 0; d < p.depth_count.size(); d++)
+            {
+                if (p.depth_count[d] > 0)
+                    depth_file << cell.tree << "," << cell.pattern << "," << cell.size << "," << cell.rep << ","
+                               << d << "," << p.depth_count[d] << "," << p.depth_ns[d] / p.depth_count[d] << "\n";
+            }
+        }
+        cout << "Depth profiles saved to " << depth_out << "\n";
+    }
+    return 0;
+}
+
+template <typename Tree>
+bool concurrentSearch(Tree &tree, int key, Contention &)
+{
+    return tree.search(key);
+}
+
+template <typename Metrics>
+bool concurrentSearch(OptimisticSplayTree<Metrics> &tree, int key, Contention &contention)
+{
+    return tree.search(key, contention);
+}
+
+// Replays the access sequence against one shared tree from 1, 2, ... up to N
+// threads, each starting at its own offset into the sequence and wrapping around,
+// and reports the throughput relative to one thread. Only trees whose searches
+// write nothing, or synchronize their writes, can take part.
+//   --scaling [--threads N] [--trees a,b] [--out file]
+int runScaling(int argc, char **argv)
+{
+    const vector<string> safe = {"OptimisticSplay", "BasicBST", "Eytzinger", "VanEmdeBoas"};
+    vector<string> trees = {"OptimisticSplay", "BasicBST", "Eytzinger"};
+    unsigned max_threads = max(1u, thread::hardware_concurrency());
+    string out = "results_scaling.csv";
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--threads")
+            max_threads = max(1, stoi(value));
+        else if (flag == "--trees")
+            trees = splitList(value);
+        else if (flag == "--out")
+            out = value;
+        else
+        {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+    for (const string &name : trees)
+    {
+        if (find(safe.begin(), safe.end(), name) == safe.end())
+        {
+            cerr << name << " cannot serve concurrent searches\n";
+            return 1;
+        }
+    }
+
+    MappedTrace insert_sequence(traceFile("insert"));
+    MappedTrace access_trace(traceFile("sequence"));
+    vector<int> accesses;
+    access_trace.forEachChunk([&](KeySpan chunk)
+    {
+        accesses.insert(accesses.end(), chunk.begin(), chunk.end());
+    });
+    if (accesses.empty())
+    {
+        cerr << "No access sequence\n";
+        return 1;
+    }
+
+    ofstream file(out);
+    file << "Algorithm,Threads,Accesses,ExecutionTime,MopsPerSec,Speedup,Rotations,Conflicts,Retries\n";
+    cout << "==================== Thread Scaling ====================\n";
+    for (const string &name : trees)
+    {
+        cout << "\n[Run] " << name << "\n";
+        printf("%-8s | %10s | %10s | %8s | %10s | %10s | %10s\n", "Threads", "Time(ms)", "Mops/s", "Speedup", "Rotations", "Conflicts", "Retries");
+        cout << string(84, '-') << "\n";
+        double base_rate = 0.0;
+        for (unsigned threads = 1; threads <= max_threads; threads++)
+        {
+            double time = 0.0;
+            vector<Contention> contention(threads);
+            withTree<NoMetrics>(name, [&](auto &tree)
+            {
+                insert_sequence.forEachChunk([&](KeySpan chunk)
+                {
+                    for (int key : chunk)
+                        tree.insert(key);
+                });
+                tree.prepare(); // builds or freezes before the threads start
+
+                atomic<bool> go(false);
+                auto replay = [&](unsigned t)
+                {
+                    pinToCore(t);
+                    while (!go.load(memory_order_acquire))
+                        this_thread::yield();
+                    size_t n = accesses.size();
+                    size_t found = 0;
+                    for (size_t i = 0, j = t * n / threads; i < n; i++, j = (j + 1 == n) ? 0 : j + 1)
+                        found += concurrentSearch(tree, accesses[j], contention[t]);
+                    searchHits.store(found, memory_order_relaxed);
+                };
+                vector<thread> workers;
+                for (unsigned t = 0; t < threads; t++)
+                    workers.emplace_back(replay, t);
+                auto start = chrono::high_resolution_clock::now();
+                go.store(true, memory_order_release);
+                for (auto &worker : workers)
+                    worker.join();
+                auto end = chrono::high_resolution_clock::now();
+                time = chrono::duration<double, milli>(end - start).count();
+            });
+
+            Contention total;
+            for (const Contention &c : contention)
+            {
+                total.rotations += c.rotations;
+                total.conflicts += c.conflicts;
+                total.retries += c.retries;
+            }
+            size_t done = accesses.size() * threads;
+            double rate = (time > 0) ? done / time / 1000.0 : 0.0;
+            if (threads == 1)
+                base_rate = rate;
+            double speedup = (base_rate > 0) ? rate / base_rate : 0.0;
+            printf("%-8u | %10.2f | %10.2f | %7.2fx | %10lld | %10lld | %10lld\n", threads, time, rate, speedup,
+                   static_cast<long long>(total.rotations), static_cast<long long>(total.conflicts), static_cast<long long>(total.retries));
+            file << name << "," << threads << "," << done << "," << time << "," << rate << "," << speedup << ","
+                 << total.rotations << "," << total.conflicts << "," << total.retries << "\n";
+        }
+    }
+    cout << "\nScaling results saved to " << out << "\n";
+    return 0;
+}
+
+// Native counterpart of generator.py that writes binary traces:
+//   --generate <type> --size n --output file.bin [--hotspots h] [--ratio r] [--seed s]
+int runGenerate(int argc, char **argv)
+{
+    string type = argv[2], out = "sequence.bin";
+    int size = 1024, hotspots = 5;
+    double ratio = 0.8;
+    uint64_t seed = random_device()();
+
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--size")
+            size = stoi(value);
+        else if (flag == "--output")
+            out = value;
+        else if (flag == "--hotspots")
+            hotspots = stoi(value);
+        else if (flag == "--ratio")
+            ratio = stod(value);
+        else if (flag == "--seed")
+            seed = stoull(value);
+        else
+        {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(seed);
+    vector<int> seq = generatePattern(type, size, rng, hotspots, ratio);
+    if (seq.empty())
+    {
+        cerr << "Unsupported sequence type or size: " << type << " " << size << "\n";
+        return 1;
+    }
+    if (!writeTrace(out, seq))
+    {
+        cerr << "Cannot write " << out << "\n";
+        return 1;
+    }
+    cout << "[OK] Sequence (" << type << ") of size " << size << " written to " << out << "\n";
+    return 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    if (argc > 1 && string(argv[1]) == "--matrix")
+        return runMatrix(argc, argv);
+    if (argc > 1 && string(argv[1]) == "--scaling")
+        return runScaling(argc, argv);
+    if (argc > 2 && string(argv[1]) == "--generate")
+        return runGenerate(argc, argv);
+
+    // --latency adds a pass per tree that times every search on its own, --batch
+    // one that runs the access loop through searchBatch, and --range a range-scan
+    // pass over the trees with ordered queries. --trace N samples every N-th access
+    // of each tree's counting run into results_<tree>_trace.bin.
+    bool latency = false, batched = false, ranged = false;
+    uint64_t trace_period = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (flag == "--latency")
+            latency = true;
+        else if (flag == "--batch")
+            batched = true;
+        else if (flag == "--range")
+            ranged = true;
+        else if (flag == "--trace" && i + 1 < argc)
+            trace_period = stoull(argv[++i]);
+    }
 
-    vector<int> insert_sequence = loadSequenceFromFile("insert.txt");
-    vector<int> access_sequence = loadSequenceFromFile("sequence.txt");
+    MappedTrace insert_sequence(traceFile("insert"));
+    MappedTrace access_sequence(traceFile("sequence"));
 
     struct Experiment
     {
         string name;
-        BST *tree;
+        BSTMetrics metrics;
+        LatencyProfile latency;
+        double batch_time;
     };
 
-    vector<Experiment> experiments = {
-        {"BasicBST", new BasicBST()},
-        {"SplayTree", new SplayTree()},
-        {"TangoTree", new TangoTree()}};
+    const vector<string> names = {"BasicBST", "SplayTree", "SemiSplay", "DepthSplay", "EveryKSplay", "RandomSplay",
+                                  "TangoTree", "MultiSplay", "FingerSkipList", "Eytzinger", "VanEmdeBoas", "BPlusTree",
+                                  "OptimisticSplay"};
+    // The static layouts rebuild on every update, so they sit out the churn phase.
+    const vector<string> churn_names = {"BasicBST", "SplayTree", "TangoTree", "MultiSplay", "FingerSkipList", "BPlusTree",
+                                        "OptimisticSplay"};
+    const vector<string> range_names = {"BasicBST", "SplayTree", "TangoTree", "FingerSkipList"};
+    vector<Experiment> experiments;
+    for (const string &name : names)
+        experiments.push_back({name, BSTMetrics(), LatencyProfile(), 0.0});
 
     cout << "==================== BST Upper Bounds ====================\n";
     for (auto &exp : experiments)
     {
         cout << "\n[Run] " << exp.name << "\n";
-        runExperiment(exp.tree, insert_sequence, access_sequence);
+        unique_ptr<AccessTrace> trace;
+        if (trace_period > 0)
+        {
+            size_t samples = access_sequence.size() / trace_period + 1;
+            trace = make_unique<AccessTrace>(trace_period, min(samples, TRACE_CAPACITY),
+                                             max<uint64_t>(access_sequence.size() / TRACE_SNAPSHOTS, 1));
+        }
+        exp.metrics = runExperiment(exp.name, insert_sequence, access_sequence, trace.get());
+        if (trace)
+        {
+            string trace_file = "results_" + exp.name + "_trace.bin";
+            if (trace->save(trace_file))
+                cout << "Trace: " << trace->recorded() << " sampled accesses saved to " << trace_file << endl;
+        }
         string filename = "results_" + exp.name + ".csv";
-        saveResultsToCSV(filename, exp.name, exp.tree->metrics);
+        saveResultsToCSV(filename, exp.name, exp.metrics);
+        if (latency)
+        {
+            exp.latency = measureLatency(exp.name, insert_sequence, access_sequence);
+            printLatency(exp.latency);
+            saveDepthProfileToCSV("results_" + exp.name + "_depth.csv", exp.latency);
+        }
+        if (batched)
+        {
+            exp.batch_time = measureBatchedTime(exp.name, insert_sequence, access_sequence);
+            cout << "Batched Execution Time: " << exp.batch_time << " ms" << endl;
+        }
     }
 
     ReferenceTree ref_tree;
-    for (int key : insert_sequence)
-        ref_tree.insert(key);
+    insert_sequence.forEachChunk([&](KeySpan chunk)
+    {
+        for (int key : chunk)
+            ref_tree.insert(key);
+    });
 
     WilberLowerBound wilber(&ref_tree);
-    int total_wilber1 = 0;
-    for (int key : access_sequence)
+    FunnelLowerBound funnel(access_sequence);
+    GreedyUpperBound greedy(access_sequence);
+    int64_t total_wilber1 = 0, total_wilber2 = 0, total_greedy = 0;
+    access_sequence.forEachChunk([&](KeySpan chunk)
     {
-        total_wilber1 += wilber.computeTurnings(key);
-    }
+        for (int key : chunk)
+        {
+            total_wilber1 += wilber.computeTurnings(key);
+            total_wilber2 += funnel.computeAlternations(key);
+            total_greedy += greedy.computeTouched(key);
+        }
+    });
 
     cout << "\n==================== Wilber I Lower Bound ====================\n";
     cout << "Estimated Wilber I Lower Bound: " << total_wilber1 << "\n";
+    cout << "\n==================== Wilber II Lower Bound ====================\n";
+    cout << "Estimated Wilber II (Funnel) Lower Bound: " << total_wilber2 << "\n";
+    cout << "\n==================== Greedy Upper Bound ====================\n";
+    cout << "Offline Greedy Touched Points: " << total_greedy << "\n";
 
     ofstream wilber_file("results_wilber.csv");
     wilber_file << "LowerBoundType,Value\n";
     wilber_file << "Wilber1," << total_wilber1 << "\n";
+    wilber_file << "Wilber2," << total_wilber2 << "\n";
+    wilber_file << "Greedy," << total_greedy << "\n";
     wilber_file.close();
 
+    // Hardware counts are shown per access, next to the logical costs, when the
+    // counters were available.
+    bool hardware = any_of(experiments.begin(), experiments.end(), [](const Experiment &exp)
+    {
+        return exp.metrics.hardware.available();
+    });
+    auto perAccess = [&](int64_t count, double accesses)
+    {
+        char cell[16];
+        if (count < 0 || accesses <= 0)
+            snprintf(cell, sizeof(cell), "%s", "-");
+        else
+            snprintf(cell, sizeof(cell), "%.2f", count / accesses);
+        return string(cell);
+    };
+
     cout << "\n==================== Summary Report ====================\n";
-    printf("%-12s | %12s | %10s | %10s | %10s | %10s\n",
-           "Algorithm", "Comparisons", "Rotations", "Time(ms)", "C/Wilber", "R/C (%)");
-    cout << string(70, '-') << "\n";
+    printf("%-15s | %12s | %10s | %10s | %10s | %10s | %10s | %10s | %8s",
+           "Algorithm", "Comparisons", "Rotations", "Time(ms)", "C/Wilber", "C/Wilber2", "C/Greedy", "R/C (%)", "B/node");
+    if (hardware)
+        printf(" | %8s | %8s | %8s | %8s | %8s | %8s", "Cyc/acc", "IPC", "L1D/acc", "LLC/acc", "BrM/acc", "TLB/acc");
+    cout << "\n" << string(hardware ? 176 : 110, '-') << "\n";
 
     for (const auto &exp : experiments)
     {
-        const auto &m = exp.tree->metrics;
+        const auto &m = exp.metrics;
         double ratio_c = (total_wilber1 > 0) ? static_cast<double>(m.total_comparisons) / total_wilber1 : 0.0;
+        double ratio_c2 = (total_wilber2 > 0) ? static_cast<double>(m.total_comparisons) / total_wilber2 : 0.0;
+        double ratio_g = (total_greedy > 0) ? static_cast<double>(m.total_comparisons) / total_greedy : 0.0;
         double ratio_r = (m.total_comparisons > 0) ? static_cast<double>(m.total_rotations) * 100.0 / m.total_comparisons : 0.0;
 
-        printf("%-12s | %12d | %10d | %10.2f | %10.2f | %9.2f%%\n",
+        printf("%-15s | %12lld | %10lld | %10.2f | %10.2f | %10.2f | %10.2f | %9.2f%% | %8.1f",
                exp.name.c_str(),
-               m.total_comparisons,
-               m.total_rotations,
+               static_cast<long long>(m.total_comparisons),
+               static_cast<long long>(m.total_rotations),
                m.total_time,
                ratio_c,
-               ratio_r);
+               ratio_c2,
+               ratio_g,
+               ratio_r,
+               m.bytes_per_node);
+        if (hardware)
+        {
+            const int64_t *hw = m.hardware.count;
+            double accesses = static_cast<double>(access_sequence.size());
+            double cycles = static_cast<double>(hw[HardwareCounts::CYCLES]);
+            printf(" | %8s | %8s | %8s | %8s | %8s | %8s",
+                   perAccess(hw[HardwareCounts::CYCLES], accesses).c_str(),
+                   perAccess(hw[HardwareCounts::CYCLES] >= 0 ? hw[HardwareCounts::INSTRUCTIONS] : -1, cycles).c_str(),
+                   perAccess(hw[HardwareCounts::L1D_MISSES], accesses).c_str(),
+                   perAccess(hw[HardwareCounts::LLC_MISSES], accesses).c_str(),
+                   perAccess(hw[HardwareCounts::BRANCH_MISSES], accesses).c_str(),
+                   perAccess(hw[HardwareCounts::DTLB_MISSES], accesses).c_str());
+        }
+        printf("\n");
     }
+    if (!hardware)
+        cout << "(Hardware counters unavailable: perf_event_open is not supported or is restricted by kernel.perf_event_paranoid.)\n";
 
-    for (auto &exp : experiments)
+    if (latency)
+    {
+        ofstream latency_file("results_latency.csv");
+        latency_file << "Algorithm,Accesses,P50Ns,P99Ns,P999Ns,MaxNs,MeanDepth\n";
+
+        cout << "\n==================== Latency Summary ====================\n";
+        printf("%-15s | %10s | %10s | %10s | %10s | %10s\n", "Algorithm", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)", "Mean depth");
+        cout << string(80, '-') << "\n";
+        for (const auto &exp : experiments)
+        {
+            const LogHistogram &h = exp.latency.latency;
+            printf("%-15s | %10llu | %10llu | %10llu | %10llu | %10.2f\n",
+                   exp.name.c_str(),
+                   static_cast<unsigned long long>(h.percentile(50)),
+                   static_cast<unsigned long long>(h.percentile(99)),
+                   static_cast<unsigned long long>(h.percentile(99.9)),
+                   static_cast<unsigned long long>(h.max()),
+                   exp.latency.meanDepth());
+            latency_file << exp.name << "," << h.count() << "," << h.percentile(50) << "," << h.percentile(99) << ","
+                         << h.percentile(99.9) << "," << h.max() << "," << exp.latency.meanDepth() << "\n";
+        }
+    }
+
+    if (batched)
+    {
+        ofstream batch_file("results_batch.csv");
+        batch_file << "Algorithm,Accesses,ExecutionTime,BatchTime,Speedup\n";
+
+        cout << "\n==================== Batched Search ====================\n";
+        printf("%-15s | %10s | %10s | %8s\n", "Algorithm", "Time(ms)", "Batch(ms)", "Speedup");
+        cout << string(53, '-') << "\n";
+        for (const auto &exp : experiments)
+        {
+            double speedup = (exp.batch_time > 0) ? exp.metrics.total_time / exp.batch_time : 0.0;
+            printf("%-15s | %10.2f | %10.2f | %7.2fx\n", exp.name.c_str(), exp.metrics.total_time, exp.batch_time, speedup);
+            batch_file << exp.name << "," << access_sequence.size() << "," << exp.metrics.total_time << "," << exp.batch_time << "," << speedup << "\n";
+        }
+    }
+
+    if (ranged)
+    {
+        vector<pair<string, RangeResult>> ranges;
+        for (const string &name : range_names)
+        {
+            cout << "\n[Range] " << name << "\n";
+            ranges.push_back({name, measureRangeScans(name, insert_sequence, access_sequence)});
+        }
+
+        ofstream range_file("results_range.csv");
+        range_file << "Algorithm,Scans,Span,Keys,Comparisons,Rotations,ExecutionTime,KeysPerMs\n";
+
+        cout << "\n==================== Range Scan ====================\n";
+        printf("%-15s | %12s | %10s | %12s | %10s | %10s\n", "Algorithm", "Comparisons", "Rotations", "Keys", "Time(ms)", "Keys/ms");
+        cout << string(84, '-') << "\n";
+        for (const auto &range : ranges)
+        {
+            const string &name = range.first;
+            const RangeResult &r = range.second;
+            double rate = (r.metrics.total_time > 0) ? r.keys / r.metrics.total_time : 0.0;
+            printf("%-15s | %12lld | %10lld | %12zu | %10.2f | %10.0f\n",
+                   name.c_str(),
+                   static_cast<long long>(r.metrics.total_comparisons),
+                   static_cast<long long>(r.metrics.total_rotations),
+                   r.keys,
+                   r.metrics.total_time,
+                   rate);
+            range_file << name << "," << r.scans << "," << RANGE_SPAN << "," << r.keys << "," << r.metrics.total_comparisons << ","
+                       << r.metrics.total_rotations << "," << r.metrics.total_time << "," << rate << "\n";
+        }
+    }
+
+    // Optional churn phase: interleaved insert/search/delete on freshly loaded trees.
+    vector<Operation> operations = loadOperationsFromFile("operations.txt");
+    if (!operations.empty())
     {
-        delete exp.tree;
+        vector<Experiment> churn;
+        for (const string &name : churn_names)
+            churn.push_back({name, BSTMetrics(), LatencyProfile(), 0.0});
+
+        cout << "\n==================== Churn Workload ====================\n";
+        for (auto &exp : churn)
+        {
+            cout << "\n[Run] " << exp.name << "\n";
+            exp.metrics = runExperiment(exp.name, insert_sequence, operations);
+            saveChurnResultsToCSV("results_" + exp.name + "_churn.csv", exp.name, operations.size(), exp.metrics);
+        }
+
+        cout << "\n==================== Churn Summary ====================\n";
+        printf("%-15s | %12s | %10s | %10s | %10s | %8s\n",
+               "Algorithm", "Comparisons", "Rotations", "Time(ms)", "Ops/ms", "B/node");
+        cout << string(79, '-') << "\n";
+        for (const auto &exp : churn)
+        {
+            const auto &m = exp.metrics;
+            printf("%-15s | %12lld | %10lld | %10.2f | %10.1f | %8.1f\n",
+                   exp.name.c_str(),
+                   static_cast<long long>(m.total_comparisons),
+                   static_cast<long long>(m.total_rotations),
+                   m.total_time,
+                   throughput(operations.size(), m),
+                   m.bytes_per_node);
+        }
     }
 
     cout << "\nAll results saved to CSV.\n";
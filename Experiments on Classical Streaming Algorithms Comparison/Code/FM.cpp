@@ -1,26 +1,43 @@
 // FM.cpp — 正宗 FM++ (FM+ + Median‑of‑ℓ)
 //
 // 用法：
-//   FMPP fm(k /*inner*/, ℓ /*outer*/);
+//   FMPP fm(k /*inner*/, ℓ /*outer*/, seed);
 //   fm.add(x);        // x 可以是 int / uint64_t
 //   double est = fm.estimate();
+//   fm.merge(other);  // 同 k, ℓ, seed, mode 的 sketch 才能合併
+//
+// 兩種模式：
+//   FMMode::Independent  每個 counter 各自一組 (a,b)，每筆資料算 k·ℓ 次雜湊
+//   FMMode::PCSA         stochastic averaging：每筆資料只算一次雜湊，
+//                        由雜湊值低位選出唯一要更新的 counter
 
 #include <vector>
 #include <random>
 #include <algorithm>
 #include <cstdint>
+#include <climits>
 #include <cmath>
+#include <cstring>
+
+#include "Wire.cpp"
+
+enum class FMMode
+{
+    Independent,
+    PCSA
+};
 
 class FMPP
 {
 public:
-    FMPP(int k, int l) : k_(k), l_(l),
-                         lzc_(l, std::vector<int>(k, 0)),
-                         seeds_(static_cast<size_t>(l) * k * 2)
+    // seed 決定所有 (a,b)：同 seed 的 sketch 用同一組雜湊，才可合併，結果也可重現
+    FMPP(int k, int l, uint64_t seed = 0x5eed, FMMode mode = FMMode::Independent)
+        : k_(k), l_(l), seed_(seed), mode_(mode),
+          lzc_(l, std::vector<int>(k, 0)),
+          seeds_(mode == FMMode::PCSA ? 2 : static_cast<size_t>(l) * k * 2)
     {
         // 為每個 counter 產生獨立 (a,b)，a 需為奇數才保證單射
-        std::random_device rd;
-        std::mt19937_64 gen(rd());
+        std::mt19937_64 gen(seed);
         std::uniform_int_distribution<uint64_t> dist(1, P - 1);
         for (size_t i = 0; i < seeds_.size(); ++i)
             seeds_[i] = dist(gen);
@@ -29,19 +46,29 @@ public:
             seeds_[idx] |= 1ULL;
     }
 
-    // 對一筆資料更新所有 counter
+    // 對一筆資料更新所有 counter（PCSA 模式只更新一個）
     template <typename T>
     inline void add(T x)
     {
         const uint64_t xu = static_cast<uint64_t>(x);
+        if (mode_ == FMMode::PCSA)
+        {
+            // 低 32 bit 以乘法映射到 k·ℓ 個 counter 之一，高 32 bit 決定 ρ（≤ 33）
+            uint64_t h = murmur_mix(universal(seeds_[0], seeds_[1], xu));
+            uint64_t c = ((h & 0xffffffffULL) * static_cast<uint64_t>(k_ * l_)) >> 32;
+            int z = rho(h | 0xffffffffULL);
+            int &cell = lzc_[c / k_][c % k_];
+            if (z > cell)
+                cell = z;
+            return;
+        }
         size_t idx = 0;
         for (int i = 0; i < l_; ++i)
         {
             for (int j = 0; j < k_; ++j, idx += 2)
             {
-                uint64_t a = seeds_[idx], b = seeds_[idx + 1];
-                uint64_t h = (a * xu + b) % P; // 2‑wise universal
-                h = murmur_mix(h);             // 再做均勻擾動
+                uint64_t h = universal(seeds_[idx], seeds_[idx + 1], xu);
+                h = murmur_mix(h); // 再做均勻擾動
                 int z = rho(h);
                 if (z > lzc_[i][j])
                     lzc_[i][j] = z;
@@ -52,6 +79,8 @@ public:
     // 取得 FM++ 估計
     double estimate() const
     {
+        if (mode_ == FMMode::PCSA)
+            return pcsa_estimate();
         std::vector<double> grp(l_);
         for (int i = 0; i < l_; ++i)
             grp[i] = fm_plus(i);
@@ -65,6 +94,52 @@ public:
         return 0.5 * (v1 + grp[mid - 1]);
     }
 
+    // 逐 counter 取 max，等同對兩條串流的聯集建 sketch；參數或 seed 不同則失敗
+    bool merge(const FMPP &o)
+    {
+        if (o.k_ != k_ || o.l_ != l_ || o.seed_ != seed_ || o.mode_ != mode_)
+            return false;
+        for (int i = 0; i < l_; ++i)
+            for (int j = 0; j < k_; ++j)
+                lzc_[i][j] = std::max(lzc_[i][j], o.lzc_[i][j]);
+        return true;
+    }
+
+    // "FMPP"（PCSA 模式為 "FMPS"）, 版本, k, ℓ, seed, 再逐一 1 byte 的 ρ（ρ ≤ 65）；
+    // (a,b) 由 seed 重建，不必存
+    std::vector<uint8_t> serialize() const
+    {
+        WireWriter w(mode_ == FMMode::PCSA ? "FMPS" : "FMPP");
+        w.varint(k_);
+        w.varint(l_);
+        w.u64(seed_);
+        for (const auto &grp : lzc_)
+            for (int z : grp)
+                w.u8(static_cast<uint8_t>(z));
+        return w.out;
+    }
+
+    // 以序列化內容取代本 sketch；格式錯誤時回傳 false 且不改動
+    bool deserialize(const uint8_t *data, size_t size)
+    {
+        const bool pcsa = size >= 4 && std::memcmp(data, "FMPS", 4) == 0;
+        WireReader r(data, size, pcsa ? "FMPS" : "FMPP");
+        uint64_t k = r.varint(), l = r.varint();
+        uint64_t seed = r.u64();
+        // 分別檢查 k、ℓ 再相乘，k·ℓ 才不會溢位
+        if (!r.ok() || k == 0 || l == 0 || k > size || l > size || k * l > size || k > INT_MAX || l > INT_MAX)
+            return false;
+        FMPP s(static_cast<int>(k), static_cast<int>(l), seed, pcsa ? FMMode::PCSA : FMMode::Independent);
+        for (auto &grp : s.lzc_)
+            for (int &z : grp)
+                if ((z = r.u8()) > 65)
+                    return false;
+        if (!r.done())
+            return false;
+        *this = std::move(s);
+        return true;
+    }
+
 private:
     // 常數
     static constexpr uint64_t P = 2305843009213693951ULL; // 2^61−1
@@ -72,9 +147,28 @@ private:
 
     // 內部狀態
     int k_, l_;
+    uint64_t seed_;
+    FMMode mode_;
     std::vector<std::vector<int>> lzc_; // ρ 值
     std::vector<uint64_t> seeds_;       // (a,b) 對
 
+    /* (a·x + b) mod P，P = 2^61−1。先把 x 化到 < P + 8，
+       128‑bit 乘積 < 2^122，再用 2^61 ≡ 1 (mod P) 折疊兩次即可，不會溢位 */
+    static inline uint64_t mulmod61(uint64_t a, uint64_t x)
+    {
+        x = (x & P) + (x >> 61);
+        unsigned __int128 p = static_cast<unsigned __int128>(a) * x;
+        uint64_t r = (static_cast<uint64_t>(p) & P) + static_cast<uint64_t>(p >> 61);
+        r = (r & P) + (r >> 61);
+        return r >= P ? r - P : r;
+    }
+
+    static inline uint64_t universal(uint64_t a, uint64_t b, uint64_t x)
+    {
+        uint64_t r = mulmod61(a, x) + b; // 2‑wise universal
+        return r >= P ? r - P : r;
+    }
+
     /* MurmurHash3 finalizer — 將 64‑bit 打散 */
     static inline uint64_t murmur_mix(uint64_t x)
     {
@@ -100,4 +194,23 @@ private:
             invsum += std::ldexp(1.0, -z); // 2^{−z}
         return φ * static_cast<double>(k_) / invsum;
     }
+
+    /* PCSA：每個 counter 只看到約 n/(k·ℓ) 筆，故 FM+ 估計乘上 counter 數；
+       沒被雜湊到的 counter 太多時（小 n）改用 linear counting */
+    double pcsa_estimate() const
+    {
+        const double m = static_cast<double>(k_) * l_;
+        double invsum = 0.0;
+        int zeros = 0;
+        for (const auto &grp : lzc_)
+            for (int z : grp)
+            {
+                invsum += std::ldexp(1.0, -z);
+                zeros += (z == 0);
+            }
+        double raw = φ * m * m / invsum;
+        if (raw <= 2.5 * m && zeros > 0)
+            return m * std::log(m / zeros);
+        return raw;
+    }
 };
\ No newline at end of file
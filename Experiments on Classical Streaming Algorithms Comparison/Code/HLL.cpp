@@ -1,12 +1,24 @@
 #include <vector>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
+#include <random>
+#include <mutex>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HLL_X86 1
+#endif
+
+#include "Wire.cpp"
 
 class HyperLogLog
 {
 private:
     int b_, m_;
+    uint64_t seed_;          // mixed into every key; sketches merge only with equal seeds
     std::vector<uint8_t> M_; // registers
 
     // Bias‐correction constants for small m
@@ -43,47 +55,582 @@ private:
         return x ? __builtin_clzll(x) : 64;
     }
 
+    inline void update(uint64_t h)
+    {
+        int idx = h >> (64 - b_);
+        int rho = lzcnt(h << b_) + 1;
+        if (rho > M_[idx])
+            M_[idx] = rho;
+    }
+
+    double finish(double sum, int zeros) const
+    {
+        double raw = alpha(m_) * m_ * m_ / sum;
+
+        // small‐range correction
+        if (raw <= 2.5 * m_ && zeros > 0)
+            return m_ * std::log(static_cast<double>(m_) / zeros);
+        return raw;
+    }
+
+    // 2^{-v} for every byte value, so the scalar sum needs no pow()
+    static const double *inv_pow2()
+    {
+        static const std::vector<double> t = []
+        {
+            std::vector<double> v(256);
+            for (int i = 0; i < 256; ++i)
+                v[i] = std::ldexp(1.0, -i);
+            return v;
+        }();
+        return t.data();
+    }
+
+    // Harmonic sum and zero count in one pass
+    static double harmonic_scalar(const uint8_t *M, int m, int &zeros)
+    {
+        const double *inv = inv_pow2();
+        double sum = 0.0;
+        zeros = 0;
+        for (int i = 0; i < m; ++i)
+        {
+            sum += inv[M[i]];
+            zeros += (M[i] == 0);
+        }
+        return sum;
+    }
+
+#ifdef HLL_X86
+    static bool has_avx2()
+    {
+        static const bool ok = __builtin_cpu_supports("avx2");
+        return ok;
+    }
+
+    // 32 registers per step: one byte compare + popcount for the zeros, and
+    // 2^{-v} built directly as the double with exponent field 1023 - v.
+    __attribute__((target("avx2,popcnt"))) static double harmonic_avx2(const uint8_t *M, int m, int &zeros)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i bias = _mm256_set1_epi64x(1023);
+        __m256d acc[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+        zeros = 0;
+        int i = 0;
+        for (; i + 32 <= m; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(M + i));
+            zeros += __builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero))));
+            for (int j = 0; j < 8; ++j)
+            {
+                int four;
+                std::memcpy(&four, M + i + 4 * j, sizeof(four));
+                __m256i e = _mm256_sub_epi64(bias, _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four)));
+                acc[j & 3] = _mm256_add_pd(acc[j & 3], _mm256_castsi256_pd(_mm256_slli_epi64(e, 52)));
+            }
+        }
+        __m256d s = _mm256_add_pd(_mm256_add_pd(acc[0], acc[1]), _mm256_add_pd(acc[2], acc[3]));
+        __m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+        double sum = _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+        int tail_zeros;
+        sum += harmonic_scalar(M + i, m - i, tail_zeros);
+        zeros += tail_zeros;
+        return sum;
+    }
+
+    static bool has_avx512()
+    {
+        static const bool ok = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+                               __builtin_cpu_supports("avx512cd");
+        return ok;
+    }
+
+    // murmur_mix, index and rho for 8 keys per step (vpmullq, vplzcntq); only the
+    // register max-updates stay scalar, as there is no conflict-free byte scatter.
+    __attribute__((target("avx512f,avx512dq,avx512cd"))) void add_batch_avx512(const uint64_t *xs, size_t n)
+    {
+        const __m512i seed = _mm512_set1_epi64(static_cast<long long>(seed_));
+        const __m512i one = _mm512_set1_epi64(1);
+        const __m512i idx_shift = _mm512_set1_epi64(64 - b_), rho_shift = _mm512_set1_epi64(b_);
+        // The zero-masked shifts are the same as the plain ones under an all-ones
+        // mask; GCC 12 warns about the undefined pass-through of the plain forms.
+        const __mmask8 all = 0xff;
+        alignas(64) uint64_t idx[8], rho[8];
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m512i x = _mm512_xor_si512(_mm512_loadu_si512(xs + i), seed);
+            x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+            x = _mm512_mullo_epi64(x, _mm512_set1_epi64(0xff51afd7ed558ccdULL));
+            x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+            x = _mm512_mullo_epi64(x, _mm512_set1_epi64(0xc4ceb9fe1a85ec53ULL));
+            x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+            _mm512_store_si512(idx, _mm512_maskz_srlv_epi64(all, x, idx_shift));
+            _mm512_store_si512(rho, _mm512_add_epi64(_mm512_lzcnt_epi64(_mm512_maskz_sllv_epi64(all, x, rho_shift)), one));
+            for (int j = 0; j < 8; ++j)
+                if (rho[j] > M_[idx[j]])
+                    M_[idx[j]] = static_cast<uint8_t>(rho[j]);
+        }
+        for (; i < n; ++i)
+            add(xs[i]);
+    }
+#endif
+
 public:
-    explicit HyperLogLog(int b)
-        : b_(b), m_(1 << b), M_(m_, 0) {}
+    explicit HyperLogLog(int b, uint64_t seed = 0)
+        : b_(b), m_(1 << b), seed_(seed), M_(m_, 0) {}
 
     // Process one element
     void add(uint64_t x)
     {
         // 1) scramble the input exactly as in FM++
-        uint64_t h = murmur_mix(x);
         // 2) use the top b_ bits as register index
-        int idx = h >> (64 - b_);
         // 3) the remaining bits determine rho
-        uint64_t w = h << b_;
-        int rho = lzcnt(w) + 1;
         // 4) update if this element exhibits a longer run of zeros
-        if (rho > M_[idx])
+        update(murmur_mix(x ^ seed_));
+    }
+
+    // Same result as calling add() on each key; hashes 8 keys per step where AVX-512
+    // is available. (AVX2 has no 64-bit multiply: emulating it with vpmuludq was
+    // measured no faster than the scalar loop, so there is no AVX2 variant.)
+    void add_batch(const uint64_t *xs, size_t n)
+    {
+#ifdef HLL_X86
+        if (has_avx512())
         {
-            M_[idx] = rho;
+            add_batch_avx512(xs, n);
+            return;
         }
+#endif
+        for (size_t i = 0; i < n; ++i)
+            add(xs[i]);
     }
 
     // Estimate distinct count
     double estimate() const
     {
-        // harmonic sum of 2^{-M_[i]}
+        int zeros;
+#ifdef HLL_X86
+        if (has_avx2())
+        {
+            double sum = harmonic_avx2(M_.data(), m_, zeros);
+            return finish(sum, zeros);
+        }
+#endif
+        return estimate_scalar();
+    }
+
+    // Portable path, also the baseline the SIMD path is benchmarked against
+    double estimate_scalar() const
+    {
+        int zeros;
+        double sum = harmonic_scalar(M_.data(), m_, zeros);
+        return finish(sum, zeros);
+    }
+
+    // Bytes actually held by the sketch: the object plus its register storage
+    size_t memory_bytes() const
+    {
+        return sizeof(*this) + M_.capacity() * sizeof(uint8_t);
+    }
+
+    // Register-wise max: afterwards the sketch is the one the union of both streams
+    // would have built. Fails unless b and seed match.
+    bool merge(const HyperLogLog &o)
+    {
+        if (o.b_ != b_ || o.seed_ != seed_)
+            return false;
+        for (int i = 0; i < m_; ++i)
+            M_[i] = std::max(M_[i], o.M_[i]);
+        return true;
+    }
+
+    // "HLLC", version, b, seed, m register bytes
+    std::vector<uint8_t> serialize() const
+    {
+        WireWriter w("HLLC");
+        w.varint(b_);
+        w.u64(seed_);
+        w.bytes(M_.data(), M_.size());
+        return w.out;
+    }
+
+    // Replaces the sketch with a serialized one; on malformed input returns false
+    // and leaves it unchanged
+    bool deserialize(const uint8_t *data, size_t size)
+    {
+        WireReader r(data, size, "HLLC");
+        uint64_t b = r.varint();
+        uint64_t seed = r.u64();
+        // check the length before allocating, so a short blob cannot ask for 2^30 bytes
+        if (!r.ok() || b < 1 || b > 30 || size != r.consumed() + (size_t(1) << b))
+            return false;
+        std::vector<uint8_t> regs(size_t(1) << b);
+        if (!r.bytes(regs.data(), regs.size()) || !r.done())
+            return false;
+        b_ = static_cast<int>(b);
+        m_ = 1 << b_;
+        seed_ = seed;
+        M_.swap(regs);
+        return true;
+    }
+};
+
+// HyperLogLog++ (Heule, Nunkesser, Hall): same hash and register rule as above,
+// with three changes for sketches that mostly see few distinct keys.
+//  * Sparse mode: until the list would outgrow the dense registers, the sketch
+//    keeps a sorted list of (index, rho) pairs at precision 25, so small sets cost
+//    a few bytes each and are counted by linear counting over 2^25 buckets.
+//    New pairs gather unsorted at the end of the list and are merged in batches.
+//  * Dense registers are packed 6 bits each (rho <= 64 - b + 1 fits).
+//  * Raw estimates up to 5m are corrected by an empirical bias table, and linear
+//    counting is used below the per-precision threshold from the paper.
+// The bias table for a precision is built once, on first use, by simulation in
+// the same way the paper built its published tables.
+class HyperLogLogPP
+{
+private:
+    static constexpr int sparse_b_ = 25;
+    static constexpr int min_b_ = 4, max_b_ = 18;
+
+    // Kept small on purpose: with millions of sketches the object itself counts.
+    // The scalars pack into 16 bytes, so the object stays at 64 bytes.
+    uint32_t sorted_ = 0;         // list_[0, sorted_) is sorted, the rest is pending
+    uint8_t b_;
+    bool sparse_ = true;
+    uint64_t seed_;
+    std::vector<uint32_t> list_;  // (index << 6 | rho) pairs, one per index once merged
+    std::vector<uint8_t> dense_;  // m 6-bit registers, plus one pad byte
+
+    int m() const { return 1 << b_; }
+    size_t dense_bytes() const { return (static_cast<size_t>(m()) * 6 + 7) / 8; }
+    size_t pending_limit() const { return std::max<size_t>(4, dense_bytes() / 16); }
+
+    static inline uint64_t murmur_mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // rho of the bits below the top `used` bits of h, at most 64 - used + 1
+    static inline int rho(uint64_t h, int used)
+    {
+        uint64_t w = h << used;
+        return (w ? std::min(__builtin_clzll(w), 64 - used) : 64 - used) + 1;
+    }
+
+    static inline double alpha(int m)
+    {
+        if (m == 16)
+            return 0.673;
+        if (m == 32)
+            return 0.697;
+        if (m == 64)
+            return 0.709;
+        return 0.7213 / (1.0 + 1.079 / m);
+    }
+
+    // Cardinality below which linear counting beats the corrected estimate
+    // (HLL++ paper, precisions 4..18)
+    static double threshold(int b)
+    {
+        static const double t[] = {10, 20, 40, 80, 220, 400, 900, 1800, 3100,
+                                   6500, 11500, 20000, 50000, 120000, 350000};
+        return t[b - min_b_];
+    }
+
+    int get(int i) const
+    {
+        size_t bit = static_cast<size_t>(i) * 6;
+        unsigned w = dense_[bit >> 3] | (dense_[(bit >> 3) + 1] << 8);
+        return (w >> (bit & 7)) & 63;
+    }
+
+    void set(int i, int v)
+    {
+        size_t bit = static_cast<size_t>(i) * 6;
+        unsigned w = dense_[bit >> 3] | (dense_[(bit >> 3) + 1] << 8);
+        w = (w & ~(63u << (bit & 7))) | (static_cast<unsigned>(v) << (bit & 7));
+        dense_[bit >> 3] = static_cast<uint8_t>(w);
+        dense_[(bit >> 3) + 1] = static_cast<uint8_t>(w >> 8);
+    }
+
+    // Drops all but the largest rho per index from a sorted list of pairs
+    static void keep_max_rho(std::vector<uint32_t> &pairs)
+    {
+        size_t out = 0;
+        for (size_t i = 0; i < pairs.size(); ++i)
+        {
+            if (out > 0 && (pairs[out - 1] >> 6) == (pairs[i] >> 6))
+                pairs[out - 1] = pairs[i]; // same index: sorted, so this rho is larger
+            else
+                pairs[out++] = pairs[i];
+        }
+        pairs.resize(out);
+    }
+
+    // Sorts the pending pairs into the list, keeping the largest rho per index
+    void merge_pending()
+    {
+        std::sort(list_.begin() + sorted_, list_.end());
+        std::inplace_merge(list_.begin(), list_.begin() + sorted_, list_.end());
+        keep_max_rho(list_);
+        sorted_ = static_cast<uint32_t>(list_.size());
+    }
+
+    // Replays sparse pairs into the dense registers. The index bits a pair has
+    // beyond precision b are the start of the dense register's rho run.
+    void apply_pairs(const std::vector<uint32_t> &pairs)
+    {
+        const int extra = sparse_b_ - b_;
+        for (uint32_t e : pairs)
+        {
+            uint32_t idx = e >> 6;
+            uint32_t low = idx & ((1u << extra) - 1);
+            int r = low ? __builtin_clz(low) - (32 - extra) + 1 : extra + static_cast<int>(e & 63);
+            int i = idx >> extra;
+            if (r > get(i))
+                set(i, r);
+        }
+    }
+
+    void to_dense()
+    {
+        merge_pending();
+        dense_.assign(dense_bytes() + 1, 0);
+        apply_pairs(list_);
+        std::vector<uint32_t>().swap(list_);
+        sorted_ = 0;
+        sparse_ = false;
+    }
+
+    double raw_estimate(double &zeros) const
+    {
+        const int m = this->m();
         double sum = 0.0;
-        for (auto v : M_)
+        zeros = 0;
+        for (int i = 0; i < m; ++i)
         {
-            sum += std::pow(2.0, -static_cast<int>(v));
+            int v = get(i);
+            sum += std::ldexp(1.0, -v);
+            zeros += (v == 0);
         }
-        double raw = alpha(m_) * m_ * m_ / sum;
+        return alpha(m) * m * m / sum;
+    }
 
-        // small‐range correction
-        if (raw <= 2.5 * m_)
+    // (mean raw estimate, bias) at 200 cardinalities up to 5m, sorted by estimate.
+    // Each trial feeds distinct pseudo-random keys to a dense sketch and keeps the
+    // harmonic sum up to date, so a checkpoint costs O(1).
+    static const std::vector<std::pair<double, double>> &bias_table(int b)
+    {
+        static std::vector<std::pair<double, double>> tables[max_b_ + 1];
+        static std::once_flag built[max_b_ + 1];
+        std::call_once(built[b], [b]()
         {
-            int V = std::count(M_.begin(), M_.end(), 0);
-            if (V > 0)
+            const int m = 1 << b, points = 200;
+            const long long top = 5LL * m;
+            const int trials = static_cast<int>(std::min(256LL, std::max(16LL, (1LL << 22) / top)));
+            std::vector<double> mean(points, 0.0);
+            std::vector<uint8_t> reg(m);
+            std::mt19937_64 gen(0x5eedULL + b);
+            for (int t = 0; t < trials; ++t)
+            {
+                std::fill(reg.begin(), reg.end(), 0);
+                double sum = m;
+                int next = 0;
+                for (long long n = 1; n <= top && next < points; ++n)
+                {
+                    uint64_t h = murmur_mix(gen());
+                    int i = h >> (64 - b), r = rho(h, b);
+                    if (r > reg[i])
+                    {
+                        sum += std::ldexp(1.0, -r) - std::ldexp(1.0, -reg[i]);
+                        reg[i] = r;
+                    }
+                    if (n == top * (next + 1) / points)
+                        mean[next++] += alpha(m) * m * m / sum;
+                }
+            }
+            for (int j = 0; j < points; ++j)
             {
-                return m_ * std::log(static_cast<double>(m_) / V);
+                double e = mean[j] / trials;
+                tables[b].push_back({e, e - static_cast<double>(top * (j + 1) / points)});
             }
+            std::sort(tables[b].begin(), tables[b].end());
+        });
+        return tables[b];
+    }
+
+    // Mean bias of the 6 table points with the nearest raw estimates
+    static double bias(int b, double raw)
+    {
+        const auto &t = bias_table(b);
+        size_t hi = std::lower_bound(t.begin(), t.end(), std::make_pair(raw, -1e300)) - t.begin();
+        size_t lo = hi;
+        for (int k = 0; k < 6 && (lo > 0 || hi < t.size()); ++k)
+        {
+            if (hi == t.size() || (lo > 0 && raw - t[lo - 1].first < t[hi].first - raw))
+                --lo;
+            else
+                ++hi;
         }
-        return raw;
+        double sum = 0.0;
+        for (size_t i = lo; i < hi; ++i)
+            sum += t[i].second;
+        return hi > lo ? sum / (hi - lo) : 0.0;
+    }
+
+public:
+    explicit HyperLogLogPP(int b, uint64_t seed = 0)
+        : b_(std::min(std::max(b, min_b_), max_b_)), seed_(seed) {}
+
+    void add(uint64_t x)
+    {
+        uint64_t h = murmur_mix(x ^ seed_);
+        if (sparse_)
+        {
+            list_.push_back(static_cast<uint32_t>(h >> (64 - sparse_b_)) << 6 | rho(h, sparse_b_));
+            if (list_.size() - sorted_ >= pending_limit())
+            {
+                merge_pending();
+                if (list_.size() * sizeof(uint32_t) >= dense_bytes())
+                    to_dense();
+            }
+            return;
+        }
+        int idx = h >> (64 - b_);
+        int r = rho(h, b_);
+        if (r > get(idx))
+            set(idx, r);
+    }
+
+    double estimate() const
+    {
+        if (sparse_)
+        {
+            // distinct indices among the merged and the pending pairs
+            std::vector<uint32_t> idx(list_);
+            for (uint32_t &e : idx)
+                e >>= 6;
+            std::sort(idx.begin(), idx.end());
+            double used = std::unique(idx.begin(), idx.end()) - idx.begin();
+            const double ms = static_cast<double>(1u << sparse_b_);
+            return ms * std::log(ms / (ms - used));
+        }
+
+        const int m = this->m();
+        double zeros;
+        double raw = raw_estimate(zeros);
+        double e = raw <= 5.0 * m ? raw - bias(b_, raw) : raw;
+        double h = zeros > 0 ? m * std::log(m / zeros) : e;
+        return h <= threshold(b_) ? h : e;
+    }
+
+    bool is_sparse() const { return sparse_; }
+
+    // Bytes actually held by the sketch, counting vector capacity
+    size_t memory_bytes() const
+    {
+        return sizeof(*this) + list_.capacity() * sizeof(uint32_t) + dense_.capacity() * sizeof(uint8_t);
+    }
+
+    // Two sparse sketches merge their lists; otherwise the result is dense and
+    // takes the register-wise max. Fails unless b and seed match.
+    bool merge(const HyperLogLogPP &o)
+    {
+        if (o.b_ != b_ || o.seed_ != seed_)
+            return false;
+        if (sparse_ && o.sparse_)
+        {
+            list_.insert(list_.end(), o.list_.begin(), o.list_.end());
+            merge_pending();
+            if (list_.size() * sizeof(uint32_t) >= dense_bytes())
+                to_dense();
+            return true;
+        }
+        if (sparse_)
+            to_dense();
+        if (o.sparse_)
+        {
+            apply_pairs(o.list_);
+            return true;
+        }
+        for (int i = 0; i < m(); ++i)
+            if (o.get(i) > get(i))
+                set(i, o.get(i));
+        return true;
+    }
+
+    // "HLLP", version, b, seed, mode, then either the sparse pairs as a count and
+    // varint deltas of the sorted list, or the packed dense registers
+    std::vector<uint8_t> serialize() const
+    {
+        WireWriter w("HLLP");
+        w.varint(b_);
+        w.u64(seed_);
+        w.u8(sparse_);
+        if (sparse_)
+        {
+            std::vector<uint32_t> pairs(list_);
+            std::sort(pairs.begin(), pairs.end());
+            keep_max_rho(pairs);
+            w.varint(pairs.size());
+            uint32_t prev = 0;
+            for (uint32_t e : pairs)
+            {
+                w.varint(e - prev);
+                prev = e;
+            }
+        }
+        else
+            w.bytes(dense_.data(), dense_bytes());
+        return w.out;
+    }
+
+    // Replaces the sketch with a serialized one; on malformed input returns false
+    // and leaves it unchanged
+    bool deserialize(const uint8_t *data, size_t size)
+    {
+        WireReader r(data, size, "HLLP");
+        uint64_t b = r.varint();
+        uint64_t seed = r.u64();
+        bool sparse = r.u8();
+        if (!r.ok() || b < min_b_ || b > max_b_)
+            return false;
+        HyperLogLogPP s(static_cast<int>(b), seed);
+        if (sparse)
+        {
+            uint64_t n = r.varint();
+            if (!r.ok() || n * sizeof(uint32_t) > s.dense_bytes())
+                return false;
+            // every pair must hold an index below 2^25 and a rho the sparse hash can
+            // produce, or apply_pairs would write past the dense registers later
+            uint64_t e = 0;
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                uint64_t d = r.varint();
+                if ((i > 0 && d < 64) || d > UINT32_MAX) // indices must be strictly increasing
+                    return false;
+                e += d;
+                const uint64_t rho = e & 63;
+                if ((e >> 6) >= (1u << sparse_b_) || rho == 0 || rho > 64 - sparse_b_ + 1)
+                    return false;
+                s.list_.push_back(static_cast<uint32_t>(e));
+            }
+            s.sorted_ = static_cast<uint32_t>(n);
+        }
+        else
+        {
+            s.dense_.assign(s.dense_bytes() + 1, 0);
+            s.sparse_ = false;
+            r.bytes(s.dense_.data(), s.dense_bytes());
+        }
+        if (!r.done())
+            return false;
+        *this = std::move(s);
+        return true;
     }
 };
\ No newline at end of file
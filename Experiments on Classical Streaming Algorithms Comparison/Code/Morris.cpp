@@ -1,45 +1,106 @@
 // Morris.cpp — 正確的 Morris++ 實作
+//
+// counter 值為 c 時每個事件以機率 2^{-c} 增量，所以到下一次增量為止的事件數
+// 服從 Geometric(2^{-c})。每個 counter 預先抽出下次增量的事件編號（due），
+// add() 平常只需遞增事件計數並與最早的 due 比較；add_n(n) 一次前進 n 個事件。
 #include <vector>
 #include <random>
 #include <cmath>
 #include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <limits>
+
+#include "Wire.cpp"
 
 class MorrisPP
 {
 private:
     int k_;                                      // 每組 counter 數量
     int l_;                                      // 組數（實驗次數）
+    uint64_t seed_;                              // 隨機數種子，固定後結果可重現
     std::vector<std::vector<int>> counters;      // counters[l_][k_]
+    std::vector<uint64_t> due_;                  // 每個 counter 下次增量的事件編號
+    uint64_t events_ = 0;                        // 已處理的事件數
+    uint64_t next_due_ = 0;                      // min(due_)
     std::mt19937_64 rng;                         // 隨機數引擎
     std::uniform_real_distribution<double> dist; // [0,1) 均勻分布
 
-public:
-    // k = 每組 counter 數量, l = 組數
-    MorrisPP(int k, int l)
-        : k_(k), l_(l),
-          counters(l, std::vector<int>(k, 0)),
-          rng(std::random_device{}()),
-          dist(0.0, 1.0)
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+    static inline uint64_t sat_add(uint64_t a, uint64_t b)
     {
+        return a > NEVER - b ? NEVER : a + b;
     }
 
-    // 處理一筆 stream 元素（x 值本身不影響計數）
-    template <typename T>
-    void add(const T & /*x*/)
+    // 值為 c 的 counter 到下次增量要幾個事件（≥ 1），以反函數法抽 Geometric(2^{-c})
+    uint64_t gap(int c)
+    {
+        if (c == 0)
+            return 1;
+        double u = 1.0 - dist(rng); // (0,1]
+        double g = std::floor(std::log(u) / std::log1p(-std::exp2(-c))) + 1.0;
+        return g >= 1.8e19 ? NEVER : static_cast<uint64_t>(g);
+    }
+
+    // 讓 due ≤ events_ 的 counter 增量（可能連續多次），並更新 next_due_
+    void advance()
     {
+        next_due_ = NEVER;
+        size_t idx = 0;
         for (auto &group : counters)
         {
             for (int &c : group)
             {
-                double p = std::exp2(-c); // 2^{-c}
-                if (dist(rng) < p)
+                uint64_t &d = due_[idx++];
+                while (d <= events_)
                 {
-                    ++c; // 以機率 2^{-c} 隨機增量
+                    ++c;
+                    d = sat_add(d, gap(c));
                 }
+                next_due_ = std::min(next_due_, d);
             }
         }
     }
 
+    // counter 值被外部改寫後重抽所有 due（幾何分布無記憶性，重抽不影響分布）
+    void reschedule()
+    {
+        size_t idx = 0;
+        for (const auto &group : counters)
+            for (int c : group)
+                due_[idx++] = sat_add(events_, gap(c));
+        next_due_ = *std::min_element(due_.begin(), due_.end());
+    }
+
+public:
+    // k = 每組 counter 數量, l = 組數, seed = 隨機數種子
+    MorrisPP(int k, int l, uint64_t seed = 0x5eed)
+        : k_(k), l_(l), seed_(seed),
+          counters(l, std::vector<int>(k, 0)),
+          due_(static_cast<size_t>(l) * k, 1), // c = 0 時下一個事件必定增量
+          next_due_(1),
+          rng(seed),
+          dist(0.0, 1.0)
+    {
+    }
+
+    // 處理一筆 stream 元素（x 值本身不影響計數）
+    template <typename T>
+    void add(const T & /*x*/)
+    {
+        if (++events_ >= next_due_)
+            advance();
+    }
+
+    // 一次處理 n 個事件，成本只與期間發生的增量次數有關（約 k·ℓ·log n）
+    void add_n(uint64_t n)
+    {
+        events_ = sat_add(events_, n);
+        if (events_ >= next_due_)
+            advance();
+    }
+
     // 最終估計：先算出各組平均，再取 median
     double estimate() const
     {
@@ -56,6 +117,65 @@ public:
         return median(grp_est);
     }
 
+    // 合併另一個同形狀的 counter 組：對每對 (x, y)，令 x ≥ y，
+    // 再依序以機率 2^{i-1-x} (i = 1..y) 增量 x。
+    // 每步使 E[2^x] 增加 2^{i-1}，合計 2^y − 1，故估計仍不偏。
+    bool merge(const MorrisPP &o)
+    {
+        if (o.k_ != k_ || o.l_ != l_)
+            return false;
+        for (int i = 0; i < l_; ++i)
+        {
+            for (int j = 0; j < k_; ++j)
+            {
+                int x = std::max(counters[i][j], o.counters[i][j]);
+                int y = std::min(counters[i][j], o.counters[i][j]);
+                for (int t = 1; t <= y; ++t)
+                {
+                    if (dist(rng) < std::exp2(t - 1 - x))
+                        ++x;
+                }
+                counters[i][j] = x;
+            }
+        }
+        reschedule();
+        return true;
+    }
+
+    // "MRPP", 版本, k, ℓ, seed, 再逐一 1 byte 的 counter（c ≤ 64 已足夠表示 2^64）
+    std::vector<uint8_t> serialize() const
+    {
+        WireWriter w("MRPP");
+        w.varint(k_);
+        w.varint(l_);
+        w.u64(seed_);
+        for (const auto &group : counters)
+            for (int c : group)
+                w.u8(static_cast<uint8_t>(c));
+        return w.out;
+    }
+
+    // 以序列化內容取代本 sketch（隨機數引擎以 seed 重新開始）；格式錯誤時回傳 false 且不改動
+    bool deserialize(const uint8_t *data, size_t size)
+    {
+        WireReader r(data, size, "MRPP");
+        uint64_t k = r.varint(), l = r.varint();
+        uint64_t seed = r.u64();
+        // 分別檢查 k、ℓ 再相乘，k·ℓ 才不會溢位
+        if (!r.ok() || k == 0 || l == 0 || k > size || l > size || k * l > size || k > INT_MAX || l > INT_MAX)
+            return false;
+        MorrisPP s(static_cast<int>(k), static_cast<int>(l), seed);
+        for (auto &group : s.counters)
+            for (int &c : group)
+                if ((c = r.u8()) > 64)
+                    return false;
+        if (!r.done())
+            return false;
+        s.reschedule();
+        *this = std::move(s);
+        return true;
+    }
+
 private:
     // 計算中位數（支援偶數/奇數長度）
     static double median(std::vector<double> v)
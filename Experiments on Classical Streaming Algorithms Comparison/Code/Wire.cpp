@@ -0,0 +1,118 @@
+// Wire.cpp — compact binary format shared by the sketches
+//
+// Every sketch serializes as: 4-byte magic, 1-byte format version, then its own
+// fields. Integers are little-endian; sizes and parameters are LEB128 varints,
+// so a blob does not depend on the host's word size or byte order.
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+static constexpr uint8_t WIRE_VERSION = 1;
+
+class WireWriter
+{
+public:
+    std::vector<uint8_t> out;
+
+    WireWriter(const char magic[4])
+    {
+        out.insert(out.end(), magic, magic + 4);
+        out.push_back(WIRE_VERSION);
+    }
+
+    void u8(uint8_t v) { out.push_back(v); }
+
+    void u64(uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void varint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    void bytes(const uint8_t *p, size_t n) { out.insert(out.end(), p, p + n); }
+};
+
+// Reads a blob written by WireWriter. Every read checks the remaining length;
+// after the first failure ok() stays false and reads return 0.
+class WireReader
+{
+public:
+    WireReader(const uint8_t *data, size_t size, const char magic[4])
+        : begin_(data), p_(data), end_(data + size)
+    {
+        ok_ = size >= 5 && std::memcmp(data, magic, 4) == 0 && data[4] == WIRE_VERSION;
+        p_ += ok_ ? 5 : 0;
+    }
+
+    bool ok() const { return ok_; }
+    size_t consumed() const { return static_cast<size_t>(p_ - begin_); }
+    bool done() const { return ok_ && p_ == end_; }
+
+    uint8_t u8()
+    {
+        if (!need(1))
+            return 0;
+        return *p_++;
+    }
+
+    uint64_t u64()
+    {
+        if (!need(8))
+            return 0;
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i)
+            v |= static_cast<uint64_t>(*p_++) << (8 * i);
+        return v;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (!need(1))
+                return 0;
+            uint8_t c = *p_++;
+            v |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return v;
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    bool bytes(uint8_t *dst, size_t n)
+    {
+        if (!need(n))
+            return false;
+        std::memcpy(dst, p_, n);
+        p_ += n;
+        return true;
+    }
+
+private:
+    const uint8_t *begin_;
+    const uint8_t *p_;
+    const uint8_t *end_;
+    bool ok_;
+
+    bool need(size_t n)
+    {
+        if (ok_ && static_cast<size_t>(end_ - p_) >= n)
+            return true;
+        ok_ = false;
+        return false;
+    }
+};
@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstddef>
+#include <cstdlib>
+#include <utility>
 
 #include "Morris.cpp"
 #include "FM.cpp"
@@ -71,16 +73,237 @@ double percentile(std::vector<double> v, double p)
 // 粗略估計 sketch 佔用空間（byte）
 size_t estimate_morris_space(int k, int l)
 {
-    return sizeof(MorrisPP) + static_cast<size_t>(l) * k * sizeof(int);
+    return sizeof(MorrisPP) + static_cast<size_t>(l) * k * (sizeof(int) + sizeof(uint64_t)); // counter + due
 }
 size_t estimate_fm_space(int k, int l)
 {
     return sizeof(FMPP) + static_cast<size_t>(l) * k * sizeof(int);
 }
-size_t estimate_hll_space(int b)
+// HLL 的空間依實際持有的記憶體計算（HLL++ 在 sparse 模式下隨資料量變化）
+size_t estimate_hll_space(const HyperLogLog &h)
 {
-    int m = 1 << b;
-    return sizeof(HyperLogLog) + static_cast<size_t>(m) * sizeof(uint8_t);
+    return h.memory_bytes();
+}
+size_t estimate_hll_space(const HyperLogLogPP &h)
+{
+    return h.memory_bytes();
+}
+
+struct MergeResult
+{
+    double single_est, merged_est;
+    size_t wire_bytes;    // all shard blobs together
+    double merge_per_sec; // deserialize + merge of one shard blob
+};
+
+// 將 input 依位置分到 shards 個 sketch，序列化後再反序列化合併，
+// 與單一 sketch 看完整條串流的估計比較。make(i) 建第 i 個 shard 的 sketch：
+// 雜湊型 sketch 必須共用 seed，Morris++ 則應各用不同 seed，否則各 shard 的亂數完全相關
+template <typename Sketch, typename Make>
+MergeResult merge_benchmark(const std::vector<int> &input, int shards, int reps, Make make)
+{
+    Sketch single = make(0);
+    std::vector<Sketch> parts;
+    for (int s = 0; s < shards; ++s)
+        parts.push_back(make(s + 1));
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        single.add(input[i]);
+        parts[i % shards].add(input[i]);
+    }
+    std::vector<std::vector<uint8_t>> blobs;
+    size_t wire_bytes = 0;
+    for (const Sketch &s : parts)
+    {
+        blobs.push_back(s.serialize());
+        wire_bytes += blobs.back().size();
+    }
+
+    Sketch merged = make(shards + 1);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r)
+    {
+        merged = make(shards + 1);
+        for (const auto &blob : blobs)
+        {
+            Sketch part = make(0);
+            if (!part.deserialize(blob.data(), blob.size()) || !merged.merge(part))
+            {
+                std::cerr << "merge failed\n";
+                std::exit(1);
+            }
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return {single.estimate(), merged.estimate(), wire_bytes, double(reps) * shards / sec};
+}
+
+void run_merge_benchmark(int n, int k, int l, int b)
+{
+    constexpr int shards = 16, reps = 20;
+    constexpr uint64_t seed = 0x5eed;
+    auto input = generate_payload(n, PayloadType::UNIQUE_RANDOM);
+
+    const std::pair<const char *, MergeResult> rows[] = {
+        {"Morris++", merge_benchmark<MorrisPP>(input, shards, reps, [&](int s)
+                                               { return MorrisPP(k, l, seed + s); })},
+        {"FM++", merge_benchmark<FMPP>(input, shards, reps, [&](int)
+                                       { return FMPP(k, l, seed); })},
+        {"HLL", merge_benchmark<HyperLogLog>(input, shards, reps, [&](int)
+                                             { return HyperLogLog(b, seed); })},
+        {"HLL++", merge_benchmark<HyperLogLogPP>(input, shards, reps, [&](int)
+                                                 { return HyperLogLogPP(b, seed); })},
+    };
+
+    std::ofstream csv("merge.csv");
+    csv << std::fixed << std::setprecision(6);
+    csv << "SKETCH,SHARDS,SINGLE_EST,MERGED_EST,DIFF,WIRE_BYTES,MERGES_PER_SEC\n";
+    std::cout << "\nShard merge (" << shards << " shards, n=" << n << ")\n"
+              << std::left << std::setw(10) << "Sketch" << std::right
+              << std::setw(14) << "Single" << std::setw(14) << "Merged"
+              << std::setw(12) << "Wire B" << std::setw(16) << "Merges/s" << '\n';
+    for (const auto &row : rows)
+    {
+        const MergeResult &r = row.second;
+        csv << row.first << ',' << shards << ',' << r.single_est << ',' << r.merged_est << ','
+            << (r.merged_est - r.single_est) / r.single_est << ','
+            << r.wire_bytes << ',' << r.merge_per_sec << '\n';
+        std::cout << std::left << std::setw(10) << row.first << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(14) << r.single_est
+                  << std::setw(14) << r.merged_est << std::setw(12) << r.wire_bytes
+                  << std::setw(16) << std::setprecision(0) << r.merge_per_sec << '\n';
+    }
+    std::cout << "CSV written to merge.csv\n";
+}
+
+// 回傳 f 每次呼叫的平均耗時（ns）
+template <typename F>
+double time_ns(int reps, F f)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r)
+        f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / reps;
+}
+
+// HLL 的 estimate / add 在 SIMD 路徑與純量路徑的比較；兩者結果須完全一致
+void run_simd_benchmark()
+{
+    constexpr size_t keys = 1 << 22;
+    std::vector<uint64_t> xs(keys);
+    std::mt19937_64 rng(0x5eed);
+    for (uint64_t &x : xs)
+        x = rng();
+
+    std::ofstream csv("simd.csv");
+    csv << std::fixed << std::setprecision(3);
+    csv << "B,ESTIMATE_SCALAR_NS,ESTIMATE_SIMD_NS,ADD_MKEYS,ADD_BATCH_MKEYS,MATCH\n";
+    std::cout << "\nHLL SIMD vs scalar (" << keys << " keys)\n"
+              << std::setw(4) << "b" << std::setw(14) << "est scalar" << std::setw(12) << "est simd"
+              << std::setw(12) << "add M/s" << std::setw(12) << "batch M/s" << std::setw(8) << "match" << '\n';
+    for (int b : {7, 10, 14, 16})
+    {
+        HyperLogLog one(b), batch(b);
+        double add_ns = time_ns(1, [&]
+                                { for (uint64_t x : xs) one.add(x); });
+        double batch_ns = time_ns(1, [&]
+                                  { batch.add_batch(xs.data(), xs.size()); });
+        const int reps = std::max(20, (1 << 24) >> b);
+        volatile double sink = 0.0;
+        double scalar_ns = time_ns(reps, [&]
+                                   { sink = sink + one.estimate_scalar(); });
+        double simd_ns = time_ns(reps, [&]
+                                 { sink = sink + one.estimate(); });
+        const bool match = one.serialize() == batch.serialize() &&
+                           std::abs(one.estimate() - one.estimate_scalar()) <= 1e-12 * one.estimate_scalar();
+
+        csv << b << ',' << scalar_ns << ',' << simd_ns << ','
+            << keys / add_ns * 1e3 << ',' << keys / batch_ns * 1e3 << ',' << match << '\n';
+        std::cout << std::fixed << std::setprecision(1) << std::setw(4) << b
+                  << std::setw(14) << scalar_ns << std::setw(12) << simd_ns
+                  << std::setw(12) << keys / add_ns * 1e3 << std::setw(12) << keys / batch_ns * 1e3
+                  << std::setw(8) << (match ? "yes" : "NO") << '\n';
+    }
+    std::cout << "CSV written to simd.csv\n";
+}
+
+// FM++ 兩種模式的準確度與吞吐量：Independent 每筆 k·ℓ 次雜湊，PCSA 每筆 1 次
+void run_fm_mode_benchmark(int k, int l)
+{
+    constexpr int reps = 5;
+    const std::pair<const char *, FMMode> modes[] = {{"Independent", FMMode::Independent},
+                                                     {"PCSA", FMMode::PCSA}};
+
+    std::ofstream csv("fm_modes.csv");
+    csv << std::fixed << std::setprecision(6);
+    csv << "MODE,N,REL_ERR,BIAS,MITEMS_PER_SEC\n";
+    std::cout << "\nFM++ modes (k=" << k << ", l=" << l << ", " << reps << " seeds)\n"
+              << std::left << std::setw(13) << "Mode" << std::right << std::setw(9) << "n"
+              << std::setw(10) << "rel err" << std::setw(10) << "bias" << std::setw(12) << "Mitems/s" << '\n';
+    for (const auto &mode : modes)
+    {
+        for (int n : {100, 10000, 100000})
+        {
+            auto input = generate_payload(n, PayloadType::UNIQUE_RANDOM);
+            double err = 0.0, bias = 0.0;
+            uint64_t seed = 0;
+            double ns = time_ns(reps, [&]
+            {
+                FMPP fm(k, l, ++seed, mode.second);
+                for (int x : input)
+                    fm.add(x);
+                double rel = (fm.estimate() - n) / n;
+                err += std::abs(rel);
+                bias += rel;
+            });
+            const double mips = n / ns * 1e3;
+            csv << mode.first << ',' << n << ',' << err / reps << ',' << bias / reps << ',' << mips << '\n';
+            std::cout << std::left << std::setw(13) << mode.first << std::right << std::setw(9) << n
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(9) << 100 * err / reps << '%' << std::setw(9) << 100 * bias / reps << '%'
+                      << std::setw(12) << mips << '\n';
+        }
+    }
+    std::cout << "CSV written to fm_modes.csv\n";
+}
+
+// Morris++ 逐筆 add() 與 add_n() 的耗時與準確度
+void run_morris_benchmark(int k, int l)
+{
+    constexpr int reps = 5;
+    struct Case
+    {
+        const char *method;
+        uint64_t n;
+    };
+    const Case cases[] = {{"add", 1000000}, {"add_n", 1000000}, {"add_n", 1000000000}, {"add_n", 1000000000000ULL}};
+
+    std::ofstream csv("morris.csv");
+    csv << std::fixed << std::setprecision(6);
+    csv << "METHOD,N,REL_ERR,MS\n";
+    std::cout << "\nMorris++ counting (k=" << k << ", l=" << l << ", " << reps << " seeds)\n"
+              << std::left << std::setw(8) << "Method" << std::right << std::setw(16) << "n"
+              << std::setw(10) << "rel err" << std::setw(12) << "ms" << '\n';
+    for (const Case &c : cases)
+    {
+        double err = 0.0;
+        uint64_t seed = 0;
+        double ns = time_ns(reps, [&]
+        {
+            MorrisPP morris(k, l, ++seed);
+            if (c.method[3] == '_')
+                morris.add_n(c.n);
+            else
+                for (uint64_t i = 0; i < c.n; ++i)
+                    morris.add(i);
+            err += std::abs(morris.estimate() - double(c.n)) / double(c.n);
+        });
+        csv << c.method << ',' << c.n << ',' << err / reps << ',' << ns / 1e6 << '\n';
+        std::cout << std::left << std::setw(8) << c.method << std::right << std::setw(16) << c.n
+                  << std::fixed << std::setprecision(2) << std::setw(9) << 100 * err / reps << '%'
+                  << std::setw(12) << std::setprecision(3) << ns / 1e6 << '\n';
+    }
+    std::cout << "CSV written to morris.csv\n";
 }
 // -----------------------------------------------------------------------------
 int main()
@@ -91,7 +314,6 @@ int main()
 
     const double spaceM_kb = estimate_morris_space(k, l) / 1024.0;
     const double spaceF_kb = estimate_fm_space(k, l) / 1024.0;
-    const double spaceH_kb = estimate_hll_space(b) / 1024.0;
 
     std::ofstream csv("output.csv");
     if (!csv)
@@ -107,7 +329,8 @@ int main()
            "TRUE_TOTAL,TRUE_DISTINCT,"
            "SPACE_M_KB,SPACE_F_KB,SPACE_H_KB,"
            "AVG_M,REL_M,AVG_F,REL_F,AVG_H,REL_H,"
-           "P99_M,P99_F,P99_H\n";
+           "P99_M,P99_F,P99_H,"
+           "EST_HPP,ERR_HPP,SPACE_HPP_KB,AVG_HPP,REL_HPP,P99_HPP\n";
 
     // for three payload patterns ---------------------------------------
     for (int pid = 0; pid < 3; ++pid)
@@ -119,35 +342,43 @@ int main()
         const int true_distinct = static_cast<int>(
             std::unordered_set<int>(input.begin(), input.end()).size());
 
-        std::vector<double> estM(trials), estF(trials), estH(trials);
-        std::vector<double> errM(trials), errF(trials), errH(trials);
+        std::vector<double> estM(trials), estF(trials), estH(trials), estP(trials);
+        std::vector<double> errM(trials), errF(trials), errH(trials), errP(trials);
+        double spaceH_kb = 0.0, spaceP_kb = 0.0;
 
         for (int t = 0; t < trials; ++t)
         {
-            MorrisPP morris(k, l);
-            FMPP fm(k, l);
+            MorrisPP morris(k, l, t + 1); // 每次 trial 換 seed，結果仍可重現
+            FMPP fm(k, l, t + 1);
             HyperLogLog hll(b);
+            HyperLogLogPP hllpp(b);
 
             for (int x : input)
             {
                 morris.add(x);
                 fm.add(x);
                 hll.add(x);
+                hllpp.add(x);
             }
             estM[t] = morris.estimate();
             estF[t] = fm.estimate();
             estH[t] = hll.estimate();
+            estP[t] = hllpp.estimate();
+            spaceH_kb = estimate_hll_space(hll) / 1024.0;
+            spaceP_kb = estimate_hll_space(hllpp) / 1024.0;
 
             errM[t] = std::abs(estM[t] - true_total) / double(true_total);
             errF[t] = std::abs(estF[t] - true_distinct) / double(true_distinct);
             errH[t] = std::abs(estH[t] - true_distinct) / double(true_distinct);
+            errP[t] = std::abs(estP[t] - true_distinct) / double(true_distinct);
 
             // TRIAL row ------------------------------------------------
             csv << "TRIAL," << payload_name(type) << ','
                 << (t + 1) << ','
                 << estM[t] << ',' << estF[t] << ',' << estH[t] << ','
                 << errM[t] << ',' << errF[t] << ',' << errH[t] << ','
-                << ",,,,,,,,,,,,\n"; // 13 empty summary columns
+                << ",,,,,,,,,,,,,," // 14 empty summary columns
+                << estP[t] << ',' << errP[t] << ",,,,\n";
         }
         // summary values -----------------------------------------------
         const double avgM = std::accumulate(estM.begin(), estM.end(), 0.0) / trials;
@@ -159,6 +390,9 @@ int main()
         const double p99M = percentile(errM, 99);
         const double p99F = percentile(errF, 99);
         const double p99H = percentile(errH, 99);
+        const double avgP = std::accumulate(estP.begin(), estP.end(), 0.0) / trials;
+        const double relP = std::accumulate(errP.begin(), errP.end(), 0.0) / trials;
+        const double p99P = percentile(errP, 99);
 
         // SUMMARY row -------------------------------------------------
         csv << "SUMMARY," << payload_name(type) << ",,"
@@ -168,10 +402,17 @@ int main()
             << avgM << ',' << relM << ','
             << avgF << ',' << relF << ','
             << avgH << ',' << relH << ','
-            << p99M << ',' << p99F << ',' << p99H << '\n';
+            << p99M << ',' << p99F << ',' << p99H << ','
+            << ",," // EST/ERR of HLL++
+            << spaceP_kb << ',' << avgP << ',' << relP << ',' << p99P << '\n';
     }
 
     csv.close();
     std::cout << "CSV written to output.csv\n";
+
+    run_merge_benchmark(n, k, l, b);
+    run_simd_benchmark();
+    run_fm_mode_benchmark(k, l);
+    run_morris_benchmark(k, l);
     return 0;
 }
\ No newline at end of file
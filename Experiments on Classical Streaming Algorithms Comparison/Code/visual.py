@@ -35,6 +35,12 @@ with open(CSV_FILE, newline="", encoding="utf-8-sig") as f:
             "p99F": float(row[21]),
             "p99H": float(row[22]),
         }
+        if len(row) > 28:  # HLL++ 欄位（舊版 output.csv 沒有）
+            metrics[p].update({
+                "spaceP": float(row[25]),
+                "relErrP": float(row[27]),
+                "p99P": float(row[28]),
+            })
 
 if not payloads:
     raise RuntimeError("No SUMMARY rows found in output.csv")
@@ -43,13 +49,14 @@ if not payloads:
 # --------------------------------------------------------------------
 def bar_chart(filename: str, title: str, ylabel: str, series: list[tuple[str, str]]):
     """series = [(metric_key, legend_label), ...]"""
+    series = [(m, label) for m, label in series if all(m in metrics[p] for p in payloads)]
     x = range(len(payloads))
-    width = 0.25
+    width = 0.8 / len(series)
     plt.figure(figsize=(6, 4))
     for i, (metric, label) in enumerate(series):
         vals = [metrics[p][metric] for p in payloads]
         plt.bar([xi + i * width for xi in x], vals, width, label=label)
-    plt.xticks([xi + width for xi in x], payloads)
+    plt.xticks([xi + width * (len(series) - 1) / 2 for xi in x], payloads)
     plt.ylabel(ylabel)
     plt.title(title)
     plt.legend()
@@ -63,21 +70,21 @@ bar_chart(
     "mean_rel_error.png",
     "Mean Relative Error by Payload",
     "Mean Relative Error",
-    [("relErrM", "Morris++"), ("relErrF", "FM++"), ("relErrH", "HLL")],
+    [("relErrM", "Morris++"), ("relErrF", "FM++"), ("relErrH", "HLL"), ("relErrP", "HLL++")],
 )
 
 bar_chart(
     "space_comparison.png",
     "Sketch Space (KB) by Payload",
     "Sketch Space (KB)",
-    [("spaceM", "Morris++"), ("spaceF", "FM++"), ("spaceH", "HLL")],
+    [("spaceM", "Morris++"), ("spaceF", "FM++"), ("spaceH", "HLL"), ("spaceP", "HLL++")],
 )
 
 bar_chart(
     "99th_tail_error.png",
     "99th Percentile Tail Error by Payload",
     "Relative Error",
-    [("p99M", "Morris++ 99th%"), ("p99F", "FM++ 99th%"), ("p99H", "HLL 99th%")],
+    [("p99M", "Morris++ 99th%"), ("p99F", "FM++ 99th%"), ("p99H", "HLL 99th%"), ("p99P", "HLL++ 99th%")],
 )
 
 print("Charts generated: mean_rel_error.png, space_comparison.png, 99th_tail_error.png")